@@ -0,0 +1,48 @@
+#!/bin/sh
+# Runs every test of evaluation.c with the system malloc and with each
+# strategy of our malloc, picked with MALLOC_STRATEGY, and prints one
+# table with the average time (ms) and heap growth (kB) of every test, one
+# with the tail latency of a single call and three with the footprint at the
+# peak of requested bytes. Pass 0 to measure the growth of the
+# whole program with statm instead of the end of the heap.
+make eval > /dev/null || exit 1
+
+OUT=/tmp/compare.$$
+./EvalStd -t $1 > $OUT.0
+for s in 1 2 3 4 5; do
+  MALLOC_STRATEGY=$s ./EvalCust -t $1 > $OUT.$s
+done
+
+# table TITLE FIELD FIELD: one cell of the two fields per test and malloc
+table() {
+awk -F '\t' -v title="$1" -v f1=$2 -v f2=$3 '
+FNR == 1 { col++ }
+{
+  if (!($1 in row)) { order[++nrows] = $1; row[$1] = 1 }
+  cell[$1, col] = $f1 " / " $f2
+}
+END {
+  printf "%-30s", title
+  split("system first best segregated next worst", label, " ")
+  for (c = 1; c <= col; c++) printf "%18s", label[c]
+  printf "\n"
+  for (r = 1; r <= nrows; r++) {
+    printf "%-30s", order[r]
+    for (c = 1; c <= col; c++)
+      printf "%18s", ((order[r], c) in cell) ? cell[order[r], c] : "-"
+    printf "\n"
+  }
+}' $OUT.0 $OUT.1 $OUT.2 $OUT.3 $OUT.4 $OUT.5
+}
+
+table "time (ms) / heap (kB)" 2 3
+echo
+table "p99 / p99.9 of a call (ns)" 4 5
+echo
+table "requested / held (kB)" 6 7
+echo
+table "mapped / RSS (kB)" 8 9
+echo
+table "largest free (kB) / blocks" 10 11
+
+rm -f $OUT.*
@@ -23,3 +23,18 @@ echo -n "********************* TEST REALLOC ... "
 read ans
 ./t5
 
+echo -n "********************* TEST THREADS ... "
+read ans
+./t6
+
+echo -n "********************* TEST ALIGNMENT ... "
+read ans
+./t7
+
+echo -n "********************* TEST STATISTICS ... "
+read ans
+./t8
+
+echo -n "********************* TEST PROFILING ... "
+read ans
+./t9
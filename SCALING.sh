@@ -0,0 +1,31 @@
+#!/bin/sh
+# Runs the multi-threaded benchmarks of bench.c with the system malloc and
+# with ours for 1, 2, 4, ... threads and prints them side by side: million
+# calls per second and peak RSS (kB). Pass the most threads to run, the
+# number of CPUs by default.
+make bench > /dev/null || exit 1
+
+OUT=/tmp/scaling.$$
+N=${1:-`getconf _NPROCESSORS_ONLN`}
+./BenchStd -t -n $N > $OUT.0
+./BenchCust -t -n $N > $OUT.1
+
+awk -F '\t' '
+FNR == 1 { col++ }
+{
+  key = $1 "\t" $2
+  if (!(key in row)) { order[++nrows] = key; row[key] = 1 }
+  calls[key, col] = $3
+  rss[key, col] = $4
+}
+END {
+  printf "%-14s %7s %20s %20s\n", "", "", "Mcalls/s", "RSS (kB)"
+  printf "%-14s %7s %10s %9s %10s %9s\n", "workload", "threads", "system", "custom", "system", "custom"
+  for (r = 1; r <= nrows; r++) {
+    split(order[r], k, "\t")
+    printf "%-14s %7s %10s %9s %10s %9s\n", k[1], k[2],
+      calls[order[r], 1], calls[order[r], 2], rss[order[r], 1], rss[order[r], 2]
+  }
+}' $OUT.0 $OUT.1
+
+rm -f $OUT.*
@@ -0,0 +1,293 @@
+/*gcc -O2 -fno-builtin -DTHREADS -DSTRATEGY=2 bench.c -o BenchCust -lpthread && gcc -O2 -fno-builtin bench.c -o BenchStd -lpthread
+  Usage: BenchCust [-t] [-n MAXTHREADS], see SCALING.sh */
+
+/*
+ * DESCRIPTION:
+ *  Multi-threaded benchmarks of our malloc (thread safe build) versus the
+ *  system malloc. Each workload runs with 1, 2, 4, ... up to MAXTHREADS
+ *  threads (the number of CPUs by default), every thread doing the same
+ *  amount of work, so an allocator that scales keeps its calls per
+ *  second per thread:
+ *
+ *   threadtest     every thread allocates and frees batches of its own
+ *   larson         every thread replaces random blocks of an array, and
+ *                  the arrays move to the next thread after every round,
+ *                  so blocks are freed by other threads than their own
+ *   prodcons       half the threads allocate blocks and pass them through
+ *                  a queue to the other half, which frees them
+ *   activefalse    every thread allocates small objects and writes them,
+ *                  slow if objects of different threads share cache lines
+ *   passivefalse   the same, after first freeing an object handed over by
+ *                  the main thread, where objects of all threads are
+ *                  neighbours
+ *
+ *  Each run is a child of its own. It prints million calls per second (a
+ *  write counts as a call in the false sharing tests) and the peak
+ *  resident set of the child. In table mode (-t) every line is
+ *      NAME   THREADS   MCALLS/S   RSS(kB)
+ */
+
+#ifdef STRATEGY
+#include "malloc.c"
+#else
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "latency.h"
+
+#define MAXTHREADS 256
+
+/* threadtest */
+#define TT_ROUNDS 200
+#define TT_BATCH 5000
+#define TT_SIZE 64
+
+/* larson */
+#define LA_ROUNDS 10
+#define LA_SLOTS 1000
+#define LA_OPS 100000     /* Blocks replaced per thread and round */
+#define LA_MINSIZE 16
+#define LA_MAXSIZE 1024
+
+/* prodcons */
+#define PC_BLOCKS 500000  /* Blocks per producer */
+#define PC_QUEUE 1024
+#define PC_MAXSIZE 512
+
+/* activefalse, passivefalse */
+#define FS_OBJECTS 20000
+#define FS_WRITES 100
+#define FS_SIZE 8
+
+typedef struct {
+  const char * name;
+  void *(*run)(void *);
+  int minThreads;
+} Workload;
+
+/* A queue from one producer to one consumer */
+typedef struct {
+  void *slot[PC_QUEUE];
+  unsigned long head;     /* Next to take, only the consumer writes it */
+  unsigned long tail;     /* Next to fill, only the producer writes it */
+} Queue;
+
+char *progname;
+bool tableMode = false;
+int nthreads;
+pthread_barrier_t barrier;
+void **slots[MAXTHREADS];         /* larson: arrays of blocks */
+Queue queues[MAXTHREADS / 2];
+char *handover[MAXTHREADS];       /* passivefalse: from the main thread */
+
+/**
+ * Workloads, every thread returns the number of calls it made
+ */
+void * threadtest(void *arg){
+  void *block[TT_BATCH];
+  long r, i;
+
+  (void) arg;
+  for(r = 0; r < TT_ROUNDS; r++){
+    for(i = 0; i < TT_BATCH; i++){
+      block[i] = malloc(TT_SIZE);
+    }
+    for(i = 0; i < TT_BATCH; i++){
+      free(block[i]);
+    }
+  }
+  return (void *)(2L * TT_ROUNDS * TT_BATCH);
+}
+
+void * larson(void *arg){
+  long id = (long) arg, r, i;
+  unsigned seed = id + 1;
+  void **block;
+  size_t size;
+  int j;
+
+  for(r = 0; r < LA_ROUNDS; r++){
+    /* The array of the thread before us in the last round */
+    block = slots[(id + r) % nthreads];
+    for(i = 0; i < LA_OPS; i++){
+      j = rand_r(&seed) % LA_SLOTS;
+      size = LA_MINSIZE + rand_r(&seed) % (LA_MAXSIZE - LA_MINSIZE + 1);
+      free(block[j]);
+      block[j] = malloc(size);
+      *(char *) block[j] = 1;
+    }
+    pthread_barrier_wait(&barrier);
+  }
+  return (void *)(2L * LA_ROUNDS * LA_OPS);
+}
+
+void * prodcons(void *arg){
+  long id = (long) arg, i;
+  Queue *q = &queues[id / 2];
+  unsigned seed = id + 1;
+  void *block;
+
+  if(id / 2 >= nthreads / 2) return (void *) 0;    /* Odd one out */
+  if(id % 2 == 0){
+    for(i = 0; i < PC_BLOCKS; i++){
+      block = malloc(1 + rand_r(&seed) % PC_MAXSIZE);
+      *(char *) block = 1;
+      while(q->tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == PC_QUEUE){
+        sched_yield();
+      }
+      q->slot[q->tail % PC_QUEUE] = block;
+      __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+    }
+  }else{
+    for(i = 0; i < PC_BLOCKS; i++){
+      while(__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->head){
+        sched_yield();
+      }
+      free(q->slot[q->head % PC_QUEUE]);
+      __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+    }
+  }
+  return (void *)(long) PC_BLOCKS;
+}
+
+/* Allocate, write and free small objects, the false sharing tests */
+long scratch(void){
+  volatile char *p;
+  long i, w;
+
+  for(i = 0; i < FS_OBJECTS; i++){
+    p = malloc(FS_SIZE);
+    for(w = 0; w < FS_WRITES; w++){
+      p[w % FS_SIZE]++;
+    }
+    free((void *) p);
+  }
+  return FS_OBJECTS * (2L + FS_WRITES);
+}
+
+void * activefalse(void *arg){
+  (void) arg;
+  return (void *) scratch();
+}
+
+void * passivefalse(void *arg){
+  free(handover[(long) arg]);
+  return (void *) scratch();
+}
+
+Workload workloads[] = {
+  {"threadtest", threadtest, 1},
+  {"larson", larson, 1},
+  {"prodcons", prodcons, 2},
+  {"activefalse", activefalse, 1},
+  {"passivefalse", passivefalse, 1}
+};
+
+/**
+ * Runs workload w with n threads, returns million calls per second
+ */
+double runThreads(Workload *w, int n){
+  pthread_t thread[MAXTHREADS];
+  unsigned long start, elapsed;
+  long i, j, calls = 0;
+  void *done;
+
+  nthreads = n;
+  pthread_barrier_init(&barrier, NULL, n);
+  if(w->run == larson){
+    for(i = 0; i < n; i++){
+      slots[i] = calloc(LA_SLOTS, sizeof(void *));
+      for(j = 0; j < LA_SLOTS; j++){
+        slots[i][j] = malloc(LA_MINSIZE);
+      }
+    }
+  }
+  if(w->run == passivefalse){
+    for(i = 0; i < n; i++){
+      handover[i] = malloc(FS_SIZE);
+    }
+  }
+
+  start = nowNanos();
+  for(i = 0; i < n; i++){
+    if(pthread_create(&thread[i], NULL, w->run, (void *) i) != 0){
+      perror(progname);
+      exit(1);
+    }
+  }
+  for(i = 0; i < n; i++){
+    pthread_join(thread[i], &done);
+    calls += (long) done;
+  }
+  elapsed = nowNanos() - start;
+  return calls * 1e3 / elapsed;
+}
+
+/* Runs workload w with n threads in a child and prints the results */
+void runBench(Workload *w, int n){
+  struct rusage ru;
+  double mcalls;
+  int fd[2], status;
+
+  fflush(stdout);
+  if(pipe(fd) < 0){
+    perror("pipe");
+    exit(1);
+  }
+  if(fork() == 0){
+    close(fd[0]);
+    mcalls = runThreads(w, n);
+    write(fd[1], &mcalls, sizeof(mcalls));
+    exit(0);
+  }
+  close(fd[1]);
+  if(read(fd[0], &mcalls, sizeof(mcalls)) != sizeof(mcalls)) mcalls = 0;
+  close(fd[0]);
+  wait4(-1, &status, 0, &ru);
+
+  if(tableMode)
+    printf("%s\t%d\t%.2f\t%ld\n", w->name, n, mcalls, ru.ru_maxrss);
+  else
+    printf("%-14s %7d %10.2f %10ld\n", w->name, n, mcalls, ru.ru_maxrss);
+}
+
+/* Thread counts 1, 2, 4, ... and last max */
+int nextCount(int n, int max){
+  return (n < max && n * 2 > max) ? max : n * 2;
+}
+
+int main(int argc, char *argv[]){
+  int i, n, maxThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  progname = (argc > 0) ? argv[0] : "";
+  for(i = 1; i < argc; i++){
+    if(!strcmp(argv[i], "-t")) tableMode = true;
+    else if(!strcmp(argv[i], "-n") && i + 1 < argc) maxThreads = atoi(argv[++i]);
+  }
+  if(maxThreads < 1) maxThreads = 1;
+  if(maxThreads > MAXTHREADS) maxThreads = MAXTHREADS;
+
+  if(!tableMode){
+    #ifdef STRATEGY
+    printf("Benchmarking custom malloc.\n");
+    #else
+    printf("Benchmarking system (stdlib) malloc.\n");
+    #endif
+    printf("%-14s %7s %10s %10s\n", "workload", "threads", "Mcalls/s", "RSS(kB)");
+  }
+
+  for(i = 0; i < sizeof(workloads)/sizeof(workloads[0]); i++){
+    for(n = 1; n <= maxThreads; n = nextCount(n, maxThreads)){
+      if(n >= workloads[i].minThreads) runBench(&workloads[i], n);
+    }
+  }
+  return 0;
+}
@@ -1,4 +1,6 @@
-/*gcc -O4 -DSTRATEGY=2 evaluation.c -o EvalCust && gcc -O4 evaluation.c -o EvalStd && ./EvalStd && echo "" && ./EvalCust */
+/*gcc -O4 -DSTRATEGY=2 evaluation.c -o EvalCust -lm && gcc -O4 evaluation.c -o EvalStd -lm && ./EvalStd && echo "" && ./EvalCust
+  MALLOC_STRATEGY picks another strategy for EvalCust, -r RUNS and -w WARMUP
+  how often each test is run */
 
 /*
  * DESCRIPTION:
@@ -14,6 +16,8 @@
 #include "malloc.c"
 #else
 #include <stdlib.h>
+#include <malloc.h>
+#include <fcntl.h>
 #endif
 
 #include <stdbool.h>
@@ -25,10 +29,50 @@
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <math.h>
+#include "latency.h"
 
 #define TIMES 1  /* How many times to do each thing (for timing) */
 #define MAX(a,b) ((a > b) ? (a) : (b))
 #define RUNS 10   /* Hów many times to run each test */
+#define WARMUP 2  /* Runs before those, not counted */
+#define MAXRUNS 1000
+
+/* Every malloc(), free() and realloc() of a test is timed on its own, see
+   TIMED. The clock is read around each call, which the loop times of the
+   tests include as well */
+enum { OP_MALLOC, OP_FREE, OP_REALLOC, NOPS };
+const char *opNames[NOPS] = {"malloc", "free", "realloc"};
+Histogram opHist[NOPS];
+
+#define TIMED(op, call) do { \
+    unsigned long start_ = nowNanos(); \
+    call; \
+    histAdd(&opHist[op], nowNanos() - start_); \
+  } while(0)
+
+/* Where the memory goes, sampled every FOOTPRINT_EVERY calls. Of the
+   bytes the test asked for (requested), the blocks hold more (held,
+   malloc_usable_size), the allocator got more still from the system
+   (mapped, from mallinfo2) and only part of that is resident (rss, from
+   smaps_rollup). The sample taken when the most was requested is kept.
+   The largest free block is only known for the custom malloc. The clock
+   of the loop times stops while sampling, see getCurrentTimeNanos. */
+#define FOOTPRINT_EVERY 256
+
+typedef struct {
+  long requested;         /* Bytes */
+  long held;
+  long mapped;
+  long rss;
+  long largestFree;       /* -1 if not known */
+  long freeBlocks;
+} Footprint;
+
+Footprint peak;
+long requestedBytes = 0, heldBytes = 0;
+long calls = 0;
+unsigned long footprintNanos = 0;   /* Spent sampling */
 
 /* Get current memory usage */
 int getCurrMemUsage(void);
@@ -36,17 +80,32 @@ int getCurrMemUsage(void);
 /* Get current end address of heap */
 void * getEndHeap(void);
 
-/* Gets the current timestamp in milliseconds */
-long getCurrentTimeMillis(void);
+/* Gets the current timestamp in nanoseconds */
+long getCurrentTimeNanos(void);
 
 /* Test methods */
 void evalSmallPieces(void);
 void evalTypicalUse(void);
 void evalFragmentedList(void);
 void evalBadBestFit(void);
+void evalHugeRealloc(void);
+void evalHugePages(int);
+void evalHugePagesOff(void);
+void evalHugePagesOn(void);
+#ifdef STRATEGY
+int setHugePages(int);
+#endif
+
+/* Runs a test RUNS times and prints the results */
+void runEval(const char *, void (*)(void));
 
 /* For printing */
-void printEvalResults(int, long);
+void printEvalResults(int, double);
+
+/* Timed calls that keep track of the bytes requested and held */
+void * evalMalloc(size_t);
+void * evalRealloc(void *, size_t, size_t);
+void evalFree(void *, size_t);
 
 /* Calculates how much memory was used when using endHeap and statm 
    respectively (returned as kB)
@@ -59,62 +118,214 @@ int sizes[30] = {15, 28, 17, 19, 22, 12, 26, 5, 18, 7, 29, 16, 6, 14,\
                  21, 20, 13, 8, 11, 24, 27, 1, 9, 4, 10, 23, 30, 3, 25, 2}; 
 
 bool useEndHeap = true;
+bool tableMode = false;		/* One line of averages per test, see runEval */
+int resultFd = -1;		/* Where the children send their results */
+int runs = RUNS, warmup = WARMUP;
+
+/* What a child sends back, see printEvalResults */
+typedef struct {
+  int memoryUsed;
+  double time;
+  Footprint footprint;
+  Histogram hist[NOPS];
+} Result;
+
+struct {
+  const char * name;
+  void (*run)(void);
+} evals[] = {
+  {"evalSmallPieces", evalSmallPieces},
+  {"evalTypicalUse", evalTypicalUse},
+  {"evalFragmentedList", evalFragmentedList},
+  {"evalBadBestFit", evalBadBestFit},
+  {"evalHugeRealloc (reallocs/s)", evalHugeRealloc},
+  {"evalHugePages (normal pages)", evalHugePagesOff},
+  {"evalHugePages (huge pages)", evalHugePagesOn}
+};
 
 int main(int argc, char *argv[])
 {
   int i;
-  if (argc > 1)
-    progname = argv[0];
-    if(!strcmp((const char *)&argv[1], "0")) useEndHeap = false;
-    else if(!strcmp((const char *)&argv[1], "1")) useEndHeap = true;
-  else
-    progname = "";
-
-  #ifdef STRATEGY
-  printf("Evaluating custom malloc.\n");  
-  printf("Strategy: %d\n", STRATEGY);
-  #else
-  printf("Evaluating system (stdlib) malloc.\n");  
-  #endif
 
-  printf("evalSmallPieces\n");
-  for(i = 0; i<RUNS; i++){
-      if(fork() == 0){
-      evalSmallPieces();
-      return 0;
-    }
-    wait(NULL);
+  progname = (argc > 0) ? argv[0] : "";
+  for(i = 1; i < argc; i++){
+    if(!strcmp(argv[i], "0")) useEndHeap = false;
+    else if(!strcmp(argv[i], "1")) useEndHeap = true;
+    else if(!strcmp(argv[i], "-t")) tableMode = true;
+    else if(!strcmp(argv[i], "-r") && i + 1 < argc) runs = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-w") && i + 1 < argc) warmup = atoi(argv[++i]);
   }
-  
-  printf("evalTypicalUse\n");
-  for(i = 0; i<RUNS; i++){
-    if(fork() == 0){
-      evalTypicalUse();
-      return 0;
-    }
-    wait(NULL);
+  if(runs < 1 || runs > MAXRUNS) runs = RUNS;
+  if(warmup < 0) warmup = WARMUP;
+
+  if(!tableMode){
+    #ifdef STRATEGY
+    printf("Evaluating custom malloc.\n");  
+    if(getenv("MALLOC_STRATEGY") != NULL)
+      printf("Strategy: %s\n", getenv("MALLOC_STRATEGY"));
+    else
+      printf("Strategy: %d\n", STRATEGY);
+    #else
+    printf("Evaluating system (stdlib) malloc.\n");  
+    #endif
   }
-  
-  printf("evalFragmentedList\n");
-  for(i = 0; i<RUNS; i++){
-    if(fork() == 0){
-      evalFragmentedList();
-      return 0;
-    }
-    wait(NULL);
+
+  for(i = 0; i < sizeof(evals)/sizeof(evals[0]); i++){
+    const char *name = evals[i].name;
+
+    #ifndef STRATEGY
+    if(evals[i].run == evalHugePagesOn) continue;
+    #else
+    /* Name the pages the test really gets */
+    if(evals[i].run == evalHugePagesOn && !setHugePages(1))
+      name = "evalHugePages (huge pages disabled in the kernel)";
+    #endif
+    runEval(name, evals[i].run);
   }
-  
-  printf("evalBadBestFit\n");
 
-  for(i = 0; i<RUNS; i++){
+  return 0;
+}
+
+#ifdef STRATEGY
+/**
+ * Makes malloc.c read MALLOC_HUGEPAGES again, set to huge, like it does
+ * on first use. Returns whether huge pages are in effect, which they are
+ * not if the kernel has them disabled.
+ */
+int setHugePages(int huge){
+  setenv("MALLOC_HUGEPAGES", huge ? "1" : "0", 1);
+  hugePages = -1;
+  return useHugePages();
+}
+#endif
+
+/* Two sided 95% quantile of Student's t distribution with n-1 degrees
+   of freedom, for the confidence interval of the mean of n runs */
+double tQuantile(int n){
+  static const double t[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447,
+    2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+    2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+    2.052, 2.048, 2.045, 2.042};
+
+  if(n < 2) return 0;
+  return (n - 1 <= 30) ? t[n - 2] : 1.960;
+}
+
+/* Read a whole result from fd, false if the child sent none */
+bool readResult(int fd, Result *r){
+  size_t got = 0;
+  ssize_t n;
+
+  while(got < sizeof(*r) && (n = read(fd, (char *) r + got, sizeof(*r) - got)) > 0){
+    got += n;
+  }
+  return got == sizeof(*r);
+}
+
+/**
+  Runs one test warmup + runs times, each in a child of its own so every
+  run starts with a fresh heap, and drops the warm-up runs. Each child
+  sends its results to the parent, which prints every run (not in table
+  mode), the mean time with its 95% confidence interval and the latency
+  percentiles of each kind of call over all counted runs, and the mean
+  footprint at peak (see Footprint). In table mode it only prints one line:
+      NAME   TIME(ms)   MEMORY_USED(kB)   P99(ns)   P99.9(ns)
+      REQUESTED(kB)   HELD(kB)   MAPPED(kB)   RSS(kB)   LARGEST_FREE(kB)
+      FREE_BLOCKS
+*/
+void runEval(const char * name, void (*run)(void)){
+  static Result r;
+  static Histogram hist[NOPS], all;
+  double times[MAXRUNS], mean = 0, var = 0, ci;
+  Footprint f = {0, 0, 0, 0, 0, 0};
+  long memSum = 0;
+  int fd[2];
+  int i, op, n = 0;
+
+  if(!tableMode) printf("%s\n", name);
+
+  memset(hist, 0, sizeof(hist));
+  memset(&all, 0, sizeof(all));
+  for(i = 0; i < warmup + runs; i++){
+    /* Or the children print whatever is still buffered once more */
+    fflush(stdout);
+    if(pipe(fd) < 0){
+      perror("pipe");
+      return;
+    }
     if(fork() == 0){
-      evalBadBestFit();
-      return 0;
+      close(fd[0]);
+      resultFd = fd[1];
+      run();
+      exit(0);
     }
+    close(fd[1]);
+    if(readResult(fd[0], &r) && i >= warmup){
+      if(!tableMode) printf("%d\t%.3f\n", r.memoryUsed, r.time);
+      memSum += r.memoryUsed;
+      times[n++] = r.time;
+      f.requested += r.footprint.requested;
+      f.held += r.footprint.held;
+      f.mapped += r.footprint.mapped;
+      f.rss += r.footprint.rss;
+      f.largestFree += r.footprint.largestFree;
+      f.freeBlocks += r.footprint.freeBlocks;
+      for(op = 0; op < NOPS; op++){
+        histMerge(&hist[op], &r.hist[op]);
+        histMerge(&all, &r.hist[op]);
+      }
+    }
+    close(fd[0]);
     wait(NULL);
   }
+  if(n == 0) return;
+
+  for(i = 0; i < n; i++) mean += times[i] / n;
+  for(i = 0; i < n; i++) var += (times[i] - mean) * (times[i] - mean);
+  ci = (n > 1) ? tQuantile(n) * sqrt(var / (n - 1) / n) : 0;
+  /* Averages in kB */
+  f.requested /= 1024 * n;
+  f.held /= 1024 * n;
+  f.mapped /= 1024 * n;
+  f.rss /= 1024 * n;
+  f.largestFree = (f.largestFree < 0) ? -1 : f.largestFree / (1024 * n);
+  f.freeBlocks /= n;
+
+  if(tableMode){
+    printf("%s\t%.3f\t%ld\t%lu\t%lu\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\n",
+           name, mean, memSum/n * (getpagesize()/1024),
+           percentile(&all, 0.99), percentile(&all, 0.999),
+           f.requested, f.held, f.mapped, f.rss, f.largestFree, f.freeBlocks);
+    fflush(stdout);
+    return;
+  }
+  printf("mean %.3f +- %.3f (95%% CI of %d runs, %d warm-up)\n", mean, ci, n, warmup);
+  printf("  at peak (kB): requested %ld, held %ld (%.1f%% used), mapped %ld "
+         "(%.1f%% held), rss %ld\n", f.requested, f.held,
+         f.held ? 100.0 * f.requested / f.held : 100.0, f.mapped,
+         f.mapped ? 100.0 * f.held / f.mapped : 100.0, f.rss);
+  if(f.largestFree >= 0)
+    printf("  largest free block %ld kB of %ld free blocks\n", f.largestFree, f.freeBlocks);
+  else
+    printf("  %ld free blocks\n", f.freeBlocks);
+  printf("  %-8s %9s %7s %7s %7s %7s %10s (ns)\n",
+         "call", "count", "mean", "p50", "p99", "p99.9", "max");
+  for(op = 0; op < NOPS; op++){
+    if(hist[op].count == 0) continue;
+    printf("  %-8s %9lu %7lu %7lu %7lu %7lu %10lu\n", opNames[op],
+           hist[op].count, hist[op].total / hist[op].count,
+           percentile(&hist[op], 0.50), percentile(&hist[op], 0.99),
+           percentile(&hist[op], 0.999), hist[op].max);
+  }
+  fflush(stdout);
+}
 
-  return 0;
+void evalHugePagesOff(){
+  evalHugePages(0);
+}
+
+void evalHugePagesOn(){
+  evalHugePages(1);
 }
 
 /**
@@ -125,8 +336,7 @@ void evalSmallPieces(){
   int startStatm, endStatm; 
   int t, i;
   int N = 9000;
-  void * addr[N];
-  long timeMillis = 0;
+  long timeNanos = 0;
   
   for(t = 0; t < TIMES; t++){
     if(t == 0){
@@ -134,34 +344,29 @@ void evalSmallPieces(){
       startStatm = getCurrMemUsage();
     }
 
-    long  tmpTime = getCurrentTimeMillis();
+    long  tmpTime = getCurrentTimeNanos();
     for(i = 0; i < N; i++){
-      addr[i] = malloc(1024);
+      evalMalloc(1024);
     }
-    long timed = (getCurrentTimeMillis()-tmpTime);
+    long timed = (getCurrentTimeNanos()-tmpTime);
 
     /*fprintf(stderr, "Time to malloc: %li\n", timed);*/
-    timeMillis += timed;
+    timeNanos += timed;
     
     if(t == 0){
       endMemory  = getEndHeap();
       endStatm = getCurrMemUsage();
     }
-
-    /*
-    for(i = 0; i < N; i++){
-      free(addr[i]);
-    } */
   }
 
-  timeMillis = timeMillis/TIMES;
+  timeNanos = timeNanos/TIMES;
   
   if(useEndHeap){
     int memUsed = getUsedMemoryHeap(startMemory, endMemory);
-    printEvalResults(memUsed, timeMillis);
+    printEvalResults(memUsed, timeNanos/1e6);
   }else{
     int memUsed = getUsedMemoryStatm(startStatm, endStatm);
-    printEvalResults(memUsed, timeMillis);
+    printEvalResults(memUsed, timeNanos/1e6);
   }
 }
 
@@ -174,7 +379,7 @@ void evalTypicalUse(){
   int t, i;
   int N = 9000;
   void * addr[N];
-  long timeMillis = 0;
+  long timeNanos = 0;
 
   for(t = 0; t < TIMES; t++){
     if(t == 0){
@@ -182,14 +387,14 @@ void evalTypicalUse(){
       startStatm = getCurrMemUsage();
     }
 
-    long tmpTime = getCurrentTimeMillis();
+    long tmpTime = getCurrentTimeNanos();
     for(i = 0; i < N; i++){
-      addr[i] = malloc(sizes[i%30]*1024);
+      addr[i] = evalMalloc(sizes[i%30]*1024);
     }
-    long timed = (getCurrentTimeMillis()-tmpTime);
+    long timed = (getCurrentTimeNanos()-tmpTime);
 
     /*fprintf(stderr, "Time to malloc: %li\n", timed);*/
-    timeMillis += timed;
+    timeNanos += timed;
     
     if(t == 0){
       endMemory  = getEndHeap();
@@ -197,18 +402,18 @@ void evalTypicalUse(){
     }
 
     for(i = 0; i < N; i++){
-      free(addr[i]);
+      evalFree(addr[i], sizes[i%30]*1024);
     } 
   }
 
-  timeMillis = timeMillis/TIMES;
+  timeNanos = timeNanos/TIMES;
   
   if(useEndHeap){
     int memUsed = getUsedMemoryHeap(startMemory, endMemory);
-    printEvalResults(memUsed, timeMillis);
+    printEvalResults(memUsed, timeNanos/1e6);
   }else{
     int memUsed = getUsedMemoryStatm(startStatm, endStatm);
-    printEvalResults(memUsed, timeMillis);
+    printEvalResults(memUsed, timeNanos/1e6);
   }
 }
 
@@ -222,40 +427,40 @@ void evalFragmentedList(){
   int i;
   int N = 9000;
   void * addr[N];
-  long timeMillis = 0;
+  long timeNanos = 0;
 
   startMemory = getEndHeap();
   startStatm = getCurrMemUsage();
 
   /* Allocate all 9000 blocks of sizes 1-30 kB */
-  long tmpTime = getCurrentTimeMillis();
+  long tmpTime = getCurrentTimeNanos();
   for(i = 0; i < N; i++){
-    addr[i] = malloc(sizes[i%30]*1024);
+    addr[i] = evalMalloc(sizes[i%30]*1024);
   }
-  long timed = (getCurrentTimeMillis()-tmpTime);
-  timeMillis += timed;
+  long timed = (getCurrentTimeNanos()-tmpTime);
+  timeNanos += timed;
 
   /* Free 1000 blocks (every 9th) */
   for(i = 0; i < 1000; i++){
-    free(addr[i*9]);
+    evalFree(addr[i*9], sizes[i*9%30]*1024);
   }
 
   /* Allocate 1000 blocks again */
-  tmpTime = getCurrentTimeMillis();
+  tmpTime = getCurrentTimeNanos();
   for(i = 0; i < 1000; i++){
-    addr[i*9] = malloc(sizes[i%30]*1024);
+    addr[i*9] = evalMalloc(sizes[i%30]*1024);
   }
-  timeMillis += (getCurrentTimeMillis()-tmpTime);
+  timeNanos += (getCurrentTimeNanos()-tmpTime);
 
   endMemory = getEndHeap();
   endStatm = getCurrMemUsage();
 
   if(useEndHeap){
     int memUsed = getUsedMemoryHeap(startMemory, endMemory);
-    printEvalResults(memUsed, timeMillis);
+    printEvalResults(memUsed, timeNanos/1e6);
   }else{
     int memUsed = getUsedMemoryStatm(startStatm, endStatm);
-    printEvalResults(memUsed, timeMillis);
+    printEvalResults(memUsed, timeNanos/1e6);
   }
 }
 
@@ -270,42 +475,153 @@ void evalBadBestFit(){
   int i;
   int N = 9000;
   void * addr[N];
-  long timeMillis = 0;
+  long timeNanos = 0;
 
   startMemory = getEndHeap();
   startStatm = getCurrMemUsage();
 
   /* Allocate all N blocks of sizes 1 kB */
-  long tmpTime = getCurrentTimeMillis();
+  long tmpTime = getCurrentTimeNanos();
   for(i = 0; i < N; i++){
-    addr[i] = malloc(1024);
+    addr[i] = evalMalloc(1024);
   }
-  long timed = (getCurrentTimeMillis()-tmpTime);
-  timeMillis += timed;
+  long timed = (getCurrentTimeNanos()-tmpTime);
+  timeNanos += timed;
 
   /* Free N blocks */
   for(i = 0; i < N; i++){
-    free(addr[i]);
+    evalFree(addr[i], 1024);
   }
 
   /* Allocate N blocks again */
-  tmpTime = getCurrentTimeMillis();
+  tmpTime = getCurrentTimeNanos();
   for(i = 0; i < N; i++){
-    addr[i] = malloc(1024);
+    addr[i] = evalMalloc(1024);
   }
-  timeMillis += (getCurrentTimeMillis()-tmpTime);
+  timeNanos += (getCurrentTimeNanos()-tmpTime);
 
   endMemory = getEndHeap();
   endStatm = getCurrMemUsage();
 
   if(useEndHeap){
     int memUsed = getUsedMemoryHeap(startMemory, endMemory);
-    printEvalResults(memUsed, timeMillis);
+    printEvalResults(memUsed, timeNanos/1e6);
   }else{
     int memUsed = getUsedMemoryStatm(startStatm, endStatm);
-    printEvalResults(memUsed, timeMillis);
+    printEvalResults(memUsed, timeNanos/1e6);
   }
 }
+/**
+  Grow one buffer from 1 MB to 1 GB in steps of 1 MB with realloc, writing
+  the first and last byte after every step. Copying the data each time
+  would move about 512 GB in total, remapping the pages moves nothing.
+  Prints reallocs per second instead of the time.
+*/
+void evalHugeRealloc(){
+  void * startMemory, *endMemory;
+  int startStatm, endStatm;
+  int i;
+  int N = 1024;
+  size_t step = 1024*1024;
+  char * buffer;
+  long timeNanos = 0;
+
+  startMemory = getEndHeap();
+  startStatm = getCurrMemUsage();
+
+  long tmpTime = getCurrentTimeNanos();
+  buffer = evalMalloc(step);
+  buffer[0] = 1;
+  for(i = 2; i <= N; i++){
+    buffer = evalRealloc(buffer, (i-1)*step, i*step);
+    if(buffer == NULL || buffer[0] != 1){
+      fprintf(stderr, "evalHugeRealloc: realloc to %d MB failed\n", i);
+      return;
+    }
+    buffer[i*step - 1] = 1;
+  }
+  timeNanos += (getCurrentTimeNanos()-tmpTime);
+
+  endMemory = getEndHeap();
+  endStatm = getCurrMemUsage();
+  evalFree(buffer, N*step);
+
+  if(timeNanos == 0) timeNanos = 1;
+  if(useEndHeap){
+    int memUsed = getUsedMemoryHeap(startMemory, endMemory);
+    printEvalResults(memUsed, 1e9*(N-1)/timeNanos);
+  }else{
+    int memUsed = getUsedMemoryStatm(startStatm, endStatm);
+    printEvalResults(memUsed, 1e9*(N-1)/timeNanos);
+  }
+}
+
+/**
+  Allocate 128 MB in 4 kB blocks linked in random order, then follow the
+  links a few times. Every step touches another page, so the time is
+  dominated by TLB misses, which huge pages cut down. The custom malloc
+  runs it with huge pages off and on, the system malloc only once. Huge
+  pages are asked for like MALLOC_HUGEPAGES does, see setHugePages.
+*/
+void evalHugePages(int huge){
+  void * startMemory, *endMemory;
+  int startStatm, endStatm;
+  int i, j;
+  int N = 32768;
+  int laps = 20;
+  size_t size = 4000;
+  void ** blocks;
+  void ** p;
+  void * tmp;
+  long timeNanos = 0;
+
+  #ifdef STRATEGY
+  setHugePages(huge);
+  #endif
+
+  startMemory = getEndHeap();
+  startStatm = getCurrMemUsage();
+
+  blocks = malloc(N * sizeof(void *));
+  for(i = 0; i < N; i++){
+    blocks[i] = evalMalloc(size);
+  }
+  /* Shuffle, then link every block to the next one in the new order */
+  srand(4711);
+  for(i = N - 1; i > 0; i--){
+    j = rand() % (i + 1);
+    tmp = blocks[i]; blocks[i] = blocks[j]; blocks[j] = tmp;
+  }
+  for(i = 0; i < N; i++){
+    *(void **) blocks[i] = blocks[(i + 1) % N];
+  }
+
+  long tmpTime = getCurrentTimeNanos();
+  p = blocks[0];
+  for(i = 0; i < laps * N; i++){
+    p = *p;
+  }
+  timeNanos += (getCurrentTimeNanos()-tmpTime);
+  if(p != blocks[0]){
+    fprintf(stderr, "evalHugePages: broken chain\n");
+  }
+
+  endMemory = getEndHeap();
+  endStatm = getCurrMemUsage();
+  for(i = 0; i < N; i++){
+    evalFree(blocks[i], size);
+  }
+  free(blocks);
+
+  if(useEndHeap){
+    int memUsed = getUsedMemoryHeap(startMemory, endMemory);
+    printEvalResults(memUsed, timeNanos/1e6);
+  }else{
+    int memUsed = getUsedMemoryStatm(startStatm, endStatm);
+    printEvalResults(memUsed, timeNanos/1e6);
+  }
+}
+
 /**
  * Returns the program size (virtual memory) in kB
  */
@@ -331,22 +647,113 @@ void * getEndHeap(){
 }
 
 /**
-  * Prints the results to stdout like this:
-  *     MEMORY_USED(kB)   TIME(ms)
+  * Sends the results, MEMORY_USED(pages) and TIME(ms), with the latencies
+  * of the calls to the parent, see runEval.
   */
-void printEvalResults(int memoryUsed, long ms){
-  printf("%d\t%li\n", memoryUsed, ms); 
+void printEvalResults(int memoryUsed, double ms){
+  static Result r;
+
+  r.memoryUsed = memoryUsed;
+  r.time = ms;
+  r.footprint = peak;
+  memcpy(r.hist, opHist, sizeof(opHist));
+  write(resultFd, &r, sizeof(r));
 }
 
 /**
-* Returns the current time in milliseconds (based on the time since the Epoch).
+* Returns the current time in nanoseconds (monotonic, not since the Epoch),
+* leaving out the time spent sampling the footprint.
 */
-long getCurrentTimeMillis()
+long getCurrentTimeNanos()
 {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
+  return nowNanos() - footprintNanos;
+}
+
+/**
+ * Returns the resident set in bytes, from /proc/self/smaps_rollup.
+ * Read without stdio, which would allocate.
+ */
+long getRss(){
+  char buf[4096], *rss;
+  int fd = open("/proc/self/smaps_rollup", O_RDONLY);
+  ssize_t n;
+
+  if(fd < 0) return -1;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if(n <= 0) return -1;
+  buf[n] = 0;
+  rss = strstr(buf, "\nRss:");
+  return (rss == NULL) ? -1 : 1024 * atol(rss + 5);
+}
 
-  return 1000*(tv.tv_sec % 10000)+ (tv.tv_usec/1000);
+/**
+ * Samples the footprint, keeping it if the most bytes are requested now.
+ */
+void sampleFootprint(){
+  unsigned long start = nowNanos();
+  struct mallinfo2 mi = mallinfo2();
+
+  if(requestedBytes >= peak.requested){
+    peak.requested = requestedBytes;
+    peak.held = heldBytes;
+    peak.mapped = mi.arena + mi.hblkhd;
+    peak.rss = getRss();
+    peak.freeBlocks = mi.ordblks;
+    peak.largestFree = -1;
+    #ifdef STRATEGY
+    {
+      FreeInfo fi;
+      Arena *a;
+
+      peak.largestFree = 0;
+      for(a = arenas; a < arenas + narenas; a++){
+        freeInfo(a, &fi);
+        if((long) fi.largest > peak.largestFree) peak.largestFree = fi.largest;
+      }
+    }
+    #endif
+  }
+  footprintNanos += nowNanos() - start;
+}
+
+/* Counts a call, sampling the footprint every FOOTPRINT_EVERY calls */
+void countCall(){
+  if(++calls % FOOTPRINT_EVERY == 0) sampleFootprint();
+}
+
+void * evalMalloc(size_t size){
+  void *p;
+
+  TIMED(OP_MALLOC, p = malloc(size));
+  if(p != NULL){
+    requestedBytes += size;
+    heldBytes += malloc_usable_size(p);
+  }
+  countCall();
+  return p;
+}
+
+void * evalRealloc(void *p, size_t oldSize, size_t size){
+  size_t held = malloc_usable_size(p);
+  void *q;
+
+  TIMED(OP_REALLOC, q = realloc(p, size));
+  if(q != NULL){
+    requestedBytes += size - oldSize;
+    heldBytes += malloc_usable_size(q) - held;
+  }
+  countCall();
+  return q;
+}
+
+void evalFree(void *p, size_t size){
+  if(p != NULL){
+    requestedBytes -= size;
+    heldBytes -= malloc_usable_size(p);
+  }
+  TIMED(OP_FREE, free(p));
+  countCall();
 }
 
 int getUsedMemoryHeap(void * start, void * end){
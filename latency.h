@@ -0,0 +1,79 @@
+#ifndef _latency_h_
+#define _latency_h_
+
+/* Latency histograms for the benchmarks, evaluation.c and replay.c
+ *
+ * Latencies in nanoseconds are counted in buckets like those of an HDR
+ * histogram: exact below SUBBUCKETS, above that SUBBUCKETS buckets per
+ * power of two, so every percentile is within 1/SUBBUCKETS of the true
+ * latency and a histogram has a fixed size whatever the range.
+ */
+#include <time.h>
+
+#define SUBBUCKETS_LOG2 5
+#define SUBBUCKETS (1 << SUBBUCKETS_LOG2)
+#define BUCKETS ((64 - SUBBUCKETS_LOG2 + 1) * SUBBUCKETS)
+
+typedef struct {
+  unsigned long count;
+  unsigned long total;    /* ns */
+  unsigned long max;
+  unsigned long bucket[BUCKETS];
+} Histogram;
+
+/* Nanoseconds on the monotonic clock */
+static inline unsigned long nowNanos(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static inline unsigned bucketOf(unsigned long ns){
+  int log2;
+
+  if(ns < SUBBUCKETS) return ns;
+  log2 = 63 - __builtin_clzl(ns);
+  return (log2 - SUBBUCKETS_LOG2 + 1) * SUBBUCKETS +
+    ((ns >> (log2 - SUBBUCKETS_LOG2)) & (SUBBUCKETS - 1));
+}
+
+/* Lowest latency of bucket b */
+static inline unsigned long bucketStart(unsigned b){
+  unsigned log2 = b / SUBBUCKETS + SUBBUCKETS_LOG2 - 1;
+
+  if(b < SUBBUCKETS) return b;
+  return (1UL << log2) + ((unsigned long)(b % SUBBUCKETS) << (log2 - SUBBUCKETS_LOG2));
+}
+
+static inline void histAdd(Histogram *h, unsigned long ns){
+  h->count++;
+  h->total += ns;
+  h->bucket[bucketOf(ns)]++;
+  if(ns > h->max) h->max = ns;
+}
+
+/* Add the latencies of histogram from to those of h */
+static inline void histMerge(Histogram *h, const Histogram *from){
+  unsigned b;
+
+  h->count += from->count;
+  h->total += from->total;
+  if(from->max > h->max) h->max = from->max;
+  for(b = 0; b < BUCKETS; b++){
+    h->bucket[b] += from->bucket[b];
+  }
+}
+
+/* Latency below which a share p of the calls fall */
+static inline unsigned long percentile(const Histogram *h, double p){
+  unsigned long seen = 0, rank = (unsigned long)(p * h->count);
+  unsigned b;
+
+  for(b = 0; b < BUCKETS; b++){
+    seen += h->bucket[b];
+    if(seen > rank) return bucketStart(b);
+  }
+  return h->max;
+}
+
+#endif /*_latency_h_ */
@@ -9,128 +9,794 @@
 
 #include <errno.h> 
 #include <sys/mman.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <execinfo.h>
+#include <time.h>
+#include "malloc.h"
+#include "trace.h"
+
+#ifdef THREADS
+#include <pthread.h>
+#endif
 
 #define NALLOC 1024		/* Minimum #units to request */
+#define HEAPGROWTH 8	/* A new chunk is at least 1/HEAPGROWTH of the heap */
 
 typedef long Align;		/* For alignment to long boundary */
 
-/* block header */
+/* block header
+ *
+ * Only size and flags are a header proper, HEADERSIZE bytes in front of
+ * the data of an allocated block. The next pointer is the first word of
+ * the data, so it is only there while the block is free. Units start
+ * HEADERSIZE bytes past a 16 byte boundary, so the data is aligned to
+ * a whole unit. */
 union header
 {
 	struct
 	{
+		unsigned size;			/* Size of this block in units */
+		unsigned flags;			/* INUSE, PREVFREE and arena index */
 		union header *ptr;		/* Next block if on free list */
-    	unsigned size;			/* Size of this block  - what unit? */ 
 	} s;
 	Align x;			/* Force alignment of blocks */
 };
 
 typedef union header Header;
 
-static Header base;				/* Empty list to get started */
-static Header *freep = NULL;	/* Start of free list */
+#define HEADERSIZE (2 * sizeof(unsigned))	/* size and flags */
+#define DATA(bp) ((void *)((char *)(bp) + HEADERSIZE))
+#define BLOCKOF(ap) ((Header *)((char *)(ap) - HEADERSIZE))
+
+/* Boundary tags
+ *
+ * Every block has its INUSE bit set while allocated, and PREVFREE set when
+ * the block physically before it is free. A free block repeats its size in
+ * the last unit (its footer) and keeps the previous pointer of its doubly
+ * linked free list in the first unit, so every block is at least two units.
+ * This lets free() find and merge both neighbours without walking any list.
+ * Each chunk from morecore() ends with a one unit fencepost that is always
+ * in use, so no block is ever merged past the end of a chunk.
+ */
+#define INUSE 1
+#define PREVFREE 2
+#define MAPPED 4		/* Block has a mapping of its own, see bigAlloc() */
+#define SAMPLED 8		/* Block is in the sample table, see profileAlloc() */
+#define ARENASHIFT 8	/* Index of the owning arena above the flag bits */
+
+#define MINUNITS 2		/* Smallest block that can be put in a free list */
+
+/* Units of a block with room for nbytes bytes of data */
+#define NUNITS(nbytes) ((nbytes) + HEADERSIZE <= MINUNITS * sizeof(Header) ? MINUNITS : \
+		((nbytes) + HEADERSIZE + sizeof(Header) - 1) / sizeof(Header))
+
+#define PREVP(bp) (((bp) + 1)->s.ptr)			/* Previous block in free list */
+#define FOOTER(bp) ((bp) + (bp)->s.size - 1)	/* Last unit of a free block */
+#define NEXTBLOCK(bp) ((bp) + (bp)->s.size)		/* Physical neighbours */
+#define PREVBLOCK(bp) ((bp) - ((bp) - 1)->s.size)
+#define ARENAOF(bp) (&arenas[(bp)->s.flags >> ARENASHIFT])
+
+/* STRATEGY 3: Segregated fit
+ *
+ * Free blocks are kept in size classes, each with its own doubly linked
+ * list, and a bitmap records which classes are non-empty so a fitting
+ * class is found with a couple of bit scans. Classes below NEXACT hold
+ * blocks of exactly that many units, above that every power of two is
+ * split into NSUBCLASS classes. The next pointer is kept in the header and
+ * the previous pointer in the first unit of the block (every block is at
+ * least two units).
+ */
+#define NEXACT_LOG2 6
+#define NEXACT (1 << NEXACT_LOG2)
+#define NSUBCLASS_LOG2 2
+#define NSUBCLASS (1 << NSUBCLASS_LOG2)
+#define NCLASSES (NEXACT + (32 - NEXACT_LOG2) * NSUBCLASS)
+#define BITSPERWORD (8 * sizeof(unsigned long))
+#define NMAPWORDS ((NCLASSES + BITSPERWORD - 1) / BITSPERWORD)
+
+/* STRATEGY 2: Best fit, STRATEGY 5: Worst fit
+ *
+ * Both use the classes and bitmap of segregated fit. A class below NEXACT is
+ * a list of blocks of exactly that size, so its first block is a best fit.
+ * Every larger class is a tree ordered by size and then address, so the
+ * smallest fitting block, lowest address first, is found in O(log n). The
+ * trees are treaps balanced by a priority hashed from the block address.
+ * The left child is kept in the header and the right child in the first
+ * unit of the block, where list blocks keep their links. Worst fit takes
+ * the largest block, the last one of the highest non-empty class.
+ *
+ * First fit (1) and next fit (4) keep one circular list instead.
+ */
+
+/* Strategy
+ *
+ * STRATEGY is the default, MALLOC_STRATEGY in the environment picks
+ * another one (by number or name) when the heap is first used, see
+ * chooseFit(). The search of the strategy is called through a pointer.
+ */
+static int strategy = STRATEGY;
+static int sizeTrees = (STRATEGY == 2 || STRATEGY == 5);	/* Large classes are trees */
+static int sizeClasses = (STRATEGY == 2 || STRATEGY == 3 || STRATEGY == 5);	/* Free blocks kept by class */
+#define LEFT(bp) ((bp)->s.ptr)
+#define RIGHT(bp) (((bp) + 1)->s.ptr)
+#define BEFORE(p, q) ((p)->s.size < (q)->s.size || \
+		((p)->s.size == (q)->s.size && (p) < (q)))
+
+/* Requests of at least MMAP_THRESHOLD bytes get a mapping of their own,
+ * which free() unmaps right away instead of keeping it in the heap */
+#define MMAP_THRESHOLD (128 * 1024)
+
+/* Slabs
+ *
+ * Requests of up to SLAB_MAXSIZE bytes are not given a Header. They are
+ * served from slabs, SLABSIZE aligned pages cut into equal slots of one
+ * slab class (a multiple of 16 bytes). The slab header at the start of the
+ * page keeps a bitmap of free slots, and the slab of an object is found by
+ * rounding its address down. All slabs are taken from one reserved region
+ * so free() can tell slab objects from Header blocks by their address.
+ * Like the heap the region is reserved without access and made usable in
+ * steps of SLABSTEP bytes as slabs are needed. Slabs with free slots are
+ * kept on a list per class, a slab that becomes empty is given back to the
+ * region for any class to reuse. Empty slabs are kept on a stack after the
+ * region, outside the slabs themselves, so their pages can be released by
+ * malloc_trim().
+ */
+#define SLABSIZE 4096
+#define SLABREGION ((size_t) 1 << (sizeof(void *) > 4 ? 34 : 26))	/* Reserved for slabs */
+#define SLABSTEP (2 * 1024 * 1024)
+#define SLAB_QUANTUM 16
+#define SLAB_MAXSIZE 256
+#define SLAB_CLASSES (SLAB_MAXSIZE / SLAB_QUANTUM)
+#define SLAB_MAPWORDS ((SLABSIZE / SLAB_QUANTUM + BITSPERWORD - 1) / BITSPERWORD)
+
+#define SLABCLASS(nbytes) (((nbytes) + SLAB_QUANTUM - 1) / SLAB_QUANTUM - 1)
+#define SLABOF(ap) ((Slab *)((unsigned long)(ap) & ~(unsigned long)(SLABSIZE - 1)))
+#define ISSLAB(ap) (slabRegion != NULL && (char *)(ap) >= slabRegion && \
+		(char *)(ap) < slabRegion + SLABREGION)
+
+typedef struct slab
+{
+	struct slab *next;			/* Slabs of the class with free slots */
+	struct slab *prev;
+	unsigned arena;				/* Index of the owning arena */
+	unsigned size;				/* Slot size in bytes */
+	unsigned nslots;
+	unsigned nfree;
+	unsigned long freeMap[SLAB_MAPWORDS];	/* Bit set if slot is free */
+} Slab;
+
+/* Offset of the first slot, keeping slots 16 byte aligned */
+#define SLAB_FIRST ((sizeof(Slab) + SLAB_QUANTUM - 1) & ~(SLAB_QUANTUM - 1))
+
+/* Transparent huge pages
+ *
+ * With MALLOC_HUGEPAGES=1 in the environment, and huge pages enabled in
+ * the kernel, the heap grows by whole huge pages at huge page boundaries
+ * and both the heap and the slab region are advised to be backed by huge
+ * pages. Slabs are handed out from the start of their region, so the
+ * small objects stay packed together in few huge pages.
+ */
+#define HUGEPAGE (2 * 1024 * 1024)
+
+static int hugePages = -1;			/* Not yet read from the environment */
+
+/* ALIGNUP: Round address or size x up to a multiple of the power of two n */
+#define ALIGNUP(x, n) (((unsigned long)(x) + (n) - 1) & ~((unsigned long)(n) - 1))
+
+static char *slabRegion = NULL;		/* Reserved on the first small request */
+static char *slabTop = NULL;		/* Slabs above have never been used */
+static char *slabLimit = NULL;		/* Slabs above are not usable yet */
+static Slab **emptySlabs = NULL;	/* Empty slabs for reuse */
+static unsigned nempty = 0;
+static unsigned ntrimmed = 0;		/* emptySlabs below this are released */
+
+/* Trimming
+ *
+ * Pages inside large free blocks are given back to the system with
+ * madvise(), the memory stays mapped and reads as zero when it is used
+ * again. Free space at the end of an arena's last chunk is unmapped. Only
+ * the end is unmapped, keeping TRIM_PAD bytes, whenever an arena has had
+ * TRIM_THRESHOLD bytes freed since it was last trimmed: walking every large
+ * free block again each time would madvise() the same pages over and over
+ * while they are reused. malloc_trim() does both.
+ */
+#define TRIM_THRESHOLD (4 * 1024 * 1024)
+#define TRIM_PAD (128 * 1024)
+#define TRIM_MINBLOCK (64 * 1024)	/* Smaller free blocks are left alone */
+
+/* Arenas
+ *
+ * A heap with its own free lists and chunks from morecore(). Without
+ * THREADS there is a single arena, in thread safe mode every arena has its
+ * own lock and threads are spread over the arenas round robin, so threads
+ * of different arenas never wait for each other. The number of arenas is
+ * read from the MALLOC_ARENAS environment variable at startup and defaults
+ * to the number of CPUs. Every block header records its arena, a block
+ * is always given back to the arena it came from.
+ *
+ * A thread freeing a block of another arena does not take that arena's
+ * lock. It pushes the block on the arena's remote free queue, a lock free
+ * stack linked through the first word of the data, and the arena takes
+ * the whole queue at once and frees the blocks the next time it allocates.
+ */
+#ifdef THREADS
+#define MAXARENAS 64
+#else
+#define MAXARENAS 1
+#endif
+
+/* Statistics
+ *
+ * Every arena counts the blocks it hands out and takes back, and the
+ * bytes in use, for its heap and for each slab class. The counters are
+ * only updated with the arena locked, so they cost a few additions.
+ * Slab objects in a thread cache count as in use. Free blocks are not
+ * counted, they are walked when the statistics are asked for, see
+ * mallinfo2() and malloc_stats(). With MALLOC_STATS_JSON set to a file
+ * name the statistics are written there as JSON when the program exits.
+ */
+typedef struct
+{
+	size_t allocs;
+	size_t frees;
+	size_t inUse;				/* Bytes */
+} Counts;
+
+static size_t mappedBlocks = 0;	/* Blocks from bigAlloc() */
+static size_t mappedBytes = 0;
+
+#ifdef THREADS
+#define STATADD(x, n) __sync_fetch_and_add(&(x), (n))
+#else
+#define STATADD(x, n) ((x) += (n))
+#endif
+
+typedef struct
+{
+	Header base[MINUNITS];		/* Empty list to get started */
+	Header *freep;				/* Start of free list */
+	Header *fence;				/* Fencepost ending the last chunk */
+	Header *classList[NCLASSES];			/* Free list of each class */
+	unsigned long classMap[NMAPWORDS];		/* Bit set if class non-empty */
+	Slab *partial[SLAB_CLASSES];			/* Slabs with free slots */
+	size_t untrimmed;			/* Bytes freed since the last trim */
+	Header *cleanLo, *cleanHi;	/* Never used since morecore(), see cleanUse() */
+	int fresh;					/* Block from split() was in the clean range */
+	size_t heapBytes;			/* Bytes from morecore() not yet trimmed */
+	Counts heap;
+	Counts slab[SLAB_CLASSES];
+#ifdef THREADS
+	pthread_mutex_t lock;
+	void *remote;				/* Blocks freed by other arenas' threads */
+#endif
+} Arena;
+
+static Arena arenas[MAXARENAS];
+static unsigned narenas = 1;
+
+#ifdef THREADS
+/* Thread safe mode
+ *
+ * Each arena has a lock. Each thread keeps a cache of slab objects of its
+ * arena, one list per slab class, that malloc() and free() use without
+ * taking the lock. An empty list is refilled with TCACHE_BATCH objects at
+ * once and a list longer than TCACHE_LIMIT gives TCACHE_BATCH back. Cached
+ * objects stay allocated in their slabs.
+ */
+#define TCACHE_BATCH 16		/* Blocks moved between cache and heap at once */
+#define TCACHE_LIMIT (4 * TCACHE_BATCH)	/* Most cached blocks of one size */
+
+#define TCACHE_UNUSED 0
+#define TCACHE_ACTIVE 1
+#define TCACHE_DEAD 2		/* Thread is exiting */
+
+typedef struct
+{
+	void *list[SLAB_CLASSES];		/* Cached objects linked through their first word */
+	unsigned count[SLAB_CLASSES];
+	int state;
+	Arena *arena;					/* Arena of the thread */
+} ThreadCache;
+
+static __thread ThreadCache tcache;
+static void tcacheExit(void *);
+static pthread_key_t tcacheKey;			/* Flushes the cache at thread exit */
+static pthread_once_t arenaOnce = PTHREAD_ONCE_INIT;
+static unsigned nextArena = 0;			/* Round robin arena assignment */
+static pthread_mutex_t growLock = PTHREAD_MUTEX_INITIALIZER;	/* morecore() and slabNew() */
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;	/* Sample table */
+
+#define LOCK(m) pthread_mutex_lock(m)
+#define UNLOCK(m) pthread_mutex_unlock(m)
+#else
+#define LOCK(m)
+#define UNLOCK(m)
+#endif
+
+
+/* sizeClass: Class of a block of numUnits units */
+static unsigned sizeClass(unsigned numUnits)
+{
+	unsigned log2;
+
+	if(numUnits < NEXACT) return numUnits;
+
+	log2 = 8 * sizeof(unsigned) - 1 - __builtin_clz(numUnits);
+	return NEXACT + (log2 - NEXACT_LOG2) * NSUBCLASS +
+		((numUnits >> (log2 - NSUBCLASS_LOG2)) & (NSUBCLASS - 1));
+}
+
+/* nextClass: First non-empty class >= c, or -1 if there is none */
+static int nextClass(Arena * a, unsigned c)
+{
+	unsigned w = c / BITSPERWORD;
+	unsigned long bits;
+
+	if(c >= NCLASSES) return -1;
+
+	bits = a->classMap[w] & (~0UL << (c % BITSPERWORD));
+	while(bits == 0)
+	{
+		if(++w == NMAPWORDS) return -1;
+		bits = a->classMap[w];
+	}
+	return w * BITSPERWORD + __builtin_ctzl(bits);
+}
+
+/* lastClass: Highest non-empty class, or -1 if there is none */
+static int lastClass(Arena * a)
+{
+	unsigned w;
+
+	for(w = NMAPWORDS; w-- > 0; )
+	{
+		if(a->classMap[w] != 0)
+		{
+			return w * BITSPERWORD + BITSPERWORD - 1 - __builtin_clzl(a->classMap[w]);
+		}
+	}
+	return -1;
+}
+
+/* priority: Treap priority of block bp */
+static unsigned long priority(Header * bp)
+{
+	unsigned long h = ((unsigned long) bp / sizeof(Header)) * 2654435761UL;
+
+	return h ^ (h >> 15);
+}
+
+/* rotateRight: Make the left child of *root the root of the subtree */
+static void rotateRight(Header ** root)
+{
+	Header *p = LEFT(*root);
+
+	LEFT(*root) = RIGHT(p);
+	RIGHT(p) = *root;
+	*root = p;
+}
+
+/* rotateLeft: Make the right child of *root the root of the subtree */
+static void rotateLeft(Header ** root)
+{
+	Header *p = RIGHT(*root);
+
+	RIGHT(*root) = LEFT(p);
+	LEFT(p) = *root;
+	*root = p;
+}
 
-int min (int a, int b)
+/* treeInsert: Put free block bp in the tree at *root */
+static void treeInsert(Header ** root, Header * bp)
 {
-	if(a < b) 
-		return a;
+	if(*root == NULL)
+	{
+		LEFT(bp) = RIGHT(bp) = NULL;
+		*root = bp;
+	}
+	else if(BEFORE(bp, *root))
+	{
+		treeInsert(&LEFT(*root), bp);
+		if(priority(LEFT(*root)) > priority(*root)) rotateRight(root);
+	}
 	else
-		return b;
+	{
+		treeInsert(&RIGHT(*root), bp);
+		if(priority(RIGHT(*root)) > priority(*root)) rotateLeft(root);
+	}
 }
-/* free: Put block ap in the free list */
-void free(void * ap)
+
+/* treeRemove: Unlink free block bp from the tree at *root */
+static void treeRemove(Header ** root, Header * bp)
 {
-	Header *bp, *p;
+	while(*root != bp)
+	{
+		root = BEFORE(bp, *root) ? &LEFT(*root) : &RIGHT(*root);
+	}
+	/* Rotate it down until it has at most one child */
+	while(LEFT(bp) != NULL && RIGHT(bp) != NULL)
+	{
+		if(priority(LEFT(bp)) > priority(RIGHT(bp)))
+		{
+			rotateRight(root);
+			root = &RIGHT(*root);
+		}
+		else
+		{
+			rotateLeft(root);
+			root = &LEFT(*root);
+		}
+	}
+	*root = (LEFT(bp) != NULL) ? LEFT(bp) : RIGHT(bp);
+}
 
-	if(ap == NULL) return;		/* Nothing to do */
+/* treeFit: Smallest block of at least nunits in the tree, or NULL */
+static Header * treeFit(Header * p, unsigned nunits)
+{
+	Header *best = NULL;
 
-	bp = (Header *) ap - 1;		/* Point to block header */
-	
-	for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+	while(p != NULL)
+	{
+		if(p->s.size >= nunits)
+		{
+			best = p;
+			p = LEFT(p);
+		}
+		else
+		{
+			p = RIGHT(p);
+		}
+	}
+	return best;
+}
+
+/* classInsert: Put free block bp first in the list of its class */
+static void classInsert(Arena * a, Header * bp)
+{
+	unsigned c = sizeClass(bp->s.size);
+
+	a->classMap[c / BITSPERWORD] |= 1UL << (c % BITSPERWORD);
+	if(sizeTrees && c >= NEXACT)
+	{
+		treeInsert(&a->classList[c], bp);
+		return;
+	}
+	bp->s.ptr = a->classList[c];
+	PREVP(bp) = NULL;
+	if(a->classList[c] != NULL)
+	{
+		PREVP(a->classList[c]) = bp;
+	}
+	a->classList[c] = bp;
+}
+
+/* classRemove: Unlink free block bp from the list of its class */
+static void classRemove(Arena * a, Header * bp)
+{
+	unsigned c = sizeClass(bp->s.size);
+
+	if(sizeTrees && c >= NEXACT)
 	{
-		if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+		treeRemove(&a->classList[c], bp);
+		if(a->classList[c] == NULL)
 		{
-	  		break;		/* Freed block at atrt or end of arena */
+			a->classMap[c / BITSPERWORD] &= ~(1UL << (c % BITSPERWORD));
 		}
+		return;
 	}
-	if(bp + bp->s.size == p->s.ptr)
-	{                     /* join to upper nb */
-		bp->s.size += p->s.ptr->s.size;
-		bp->s.ptr = p->s.ptr->s.ptr;
+	if(PREVP(bp) != NULL)
+	{
+		PREVP(bp)->s.ptr = bp->s.ptr;
 	}
 	else
 	{
-		bp->s.ptr = p->s.ptr;
+		a->classList[c] = bp->s.ptr;
+		if(a->classList[c] == NULL)
+		{
+			a->classMap[c / BITSPERWORD] &= ~(1UL << (c % BITSPERWORD));
+		}
+	}
+	if(bp->s.ptr != NULL)
+	{
+		PREVP(bp->s.ptr) = PREVP(bp);
+	}
+}
+
+/* listInsert: Put free block bp in the free list */
+static void listInsert(Arena * a, Header * bp)
+{
+	if(sizeClasses)
+	{
+		classInsert(a, bp);
+		return;
+	}
+	/* Right after freep so the next search starts with it */
+	bp->s.ptr = a->freep->s.ptr;
+	PREVP(bp) = a->freep;
+	PREVP(a->freep->s.ptr) = bp;
+	a->freep->s.ptr = bp;
+}
+
+/* listRemove: Unlink free block bp from the free list */
+static void listRemove(Arena * a, Header * bp)
+{
+	if(sizeClasses)
+	{
+		classRemove(a, bp);
+		return;
+	}
+	PREVP(bp)->s.ptr = bp->s.ptr;
+	PREVP(bp->s.ptr) = PREVP(bp);
+	if(a->freep == bp)
+	{
+		a->freep = PREVP(bp);
+	}
+}
+
+/* cleanUse: Take allocated block bp out of the clean range of arena a.
+ *
+ * The units from cleanLo up to cleanHi are still zero from the system,
+ * except that the unit just below cleanHi may hold the footer of the free
+ * block they are part of. A block taken from below the range, like the
+ * front of the last block of the heap (see split()) or a block grown in
+ * place, may leave a free block after it, so the range then starts past
+ * the header and links of that block. A block taken from inside the
+ * range ends it. a->fresh tells whether bp was inside it and so holds
+ * nothing but zeros, apart from its first two and last unit, which may
+ * hold the links and footer of the free block it came from */
+static void cleanUse(Arena * a, Header * bp)
+{
+	a->fresh = (bp + MINUNITS >= a->cleanLo && NEXTBLOCK(bp) <= a->cleanHi);
+	if(NEXTBLOCK(bp) + MINUNITS > a->cleanLo && bp < a->cleanHi)
+	{
+		if(bp >= a->cleanLo)
+		{
+			a->cleanHi = bp;
+		}
+		else
+		{
+			a->cleanLo = NEXTBLOCK(bp) + MINUNITS;
+		}
+	}
+}
+
+/* split: Allocate nunits from the tail end of free block p. The remainder
+ * stays free unless it is too small to be listed, then the whole block
+ * is allocated. The last block of the heap is cut from the front instead,
+ * so what is left of it borders the fencepost and merges with the next
+ * chunk from morecore() rather than staying behind as a small block
+ * every later search has to pass. */
+static Header * split(Arena * a, Header * p, unsigned nunits)
+{
+	unsigned arenaBits = p->s.flags & ~(INUSE | PREVFREE);
+	Header *rest;
+
+	if(p->s.size - nunits < MINUNITS)
+	{
+		listRemove(a, p);
+		p->s.flags |= INUSE;
+	}
+	else if(NEXTBLOCK(p) == a->fence)
+	{
+		listRemove(a, p);
+		rest = p + nunits;
+		rest->s.size = p->s.size - nunits;
+		rest->s.flags = arenaBits;
+		FOOTER(rest)->s.size = rest->s.size;
+		listInsert(a, rest);
+
+		p->s.size = nunits;
+		p->s.flags |= INUSE;
+		cleanUse(a, p);
+		return p;
 	}
-    /* Join to lower nbr */	
-	if(p + p->s.size == bp)
-	  {
-	    p->s.size += bp->s.size;
-	    p->s.ptr = bp->s.ptr;
-	  }
 	else
-	  {
-	    p->s.ptr = bp;
-	  }
-	freep = p;
+	{
+		/* A class list must be told the new size */
+		if(sizeClasses) classRemove(a, p);
+		p->s.size -= nunits;
+		if(sizeClasses) classInsert(a, p);
+		FOOTER(p)->s.size = p->s.size;
+
+		p += p->s.size;
+		p->s.size = nunits;
+		p->s.flags = INUSE | PREVFREE | arenaBits;
+	}
+	NEXTBLOCK(p)->s.flags &= ~PREVFREE;
+	cleanUse(a, p);
+	return p;
+}
+
+/* heapFree: Put block bp in the free list of its arena a */
+static void heapFree(Arena * a, Header * bp)
+{
+	Header *p;
+
+	bp->s.flags &= ~(INUSE | SAMPLED);
+
+	/* Join to upper nbr */
+	p = NEXTBLOCK(bp);
+	if(!(p->s.flags & INUSE))
+	{
+		listRemove(a, p);
+		bp->s.size += p->s.size;
+	}
+	/* Join to lower nbr */
+	if(bp->s.flags & PREVFREE)
+	{
+		p = PREVBLOCK(bp);
+		listRemove(a, p);
+		p->s.size += bp->s.size;
+		bp = p;
+	}
+	FOOTER(bp)->s.size = bp->s.size;
+	NEXTBLOCK(bp)->s.flags |= PREVFREE;
+	listInsert(a, bp);
+}
+
+static void statsExit(void);
+
+static int statsReady = 0;		/* statsInit() has run */
+
+/* statsInit: Have the statistics written at exit if asked to. atexit()
+ * may allocate, so it is called without any lock held */
+static void statsInit(void)
+{
+	int dump;
+
+	LOCK(&growLock);
+	dump = (!statsReady && getenv("MALLOC_STATS_JSON") != NULL);
+	statsReady = 1;
+	UNLOCK(&growLock);
+	if(dump)
+	{
+		atexit(statsExit);
+	}
+}
+
+/* useHugePages: Whether to ask for huge pages, growLock is held */
+static int useHugePages(void)
+{
+	char *env, buf[64];
+	int fd, n;
+
+	if(hugePages >= 0) return hugePages;
+
+	hugePages = 0;
+	env = getenv("MALLOC_HUGEPAGES");
+	if(env == NULL || atoi(env) == 0) return 0;
+
+	/* Fall back to normal pages when the kernel has them disabled */
+	fd = open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY);
+	if(fd < 0) return 0;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(n <= 0) return 0;
+	buf[n] = '\0';
+	hugePages = (strstr(buf, "[never]") == NULL);
+	return hugePages;
+}
+
+/* adviseHugePages: Ask for huge pages to back length bytes at start */
+static void adviseHugePages(void * start, size_t length)
+{
+#ifdef MADV_HUGEPAGE
+	madvise(start, length, MADV_HUGEPAGE);
+#endif
 }
 
 /* morecore: ask system for more memory */
 
 #ifdef MMAP
 
-static void * __endHeap = 0;
+/* The heap is one range of address space reserved up front without any
+ * access or backing store. morecore() makes pages at its end usable with
+ * mprotect(), so consecutive chunks are always adjacent and growing the
+ * heap is cheap. Should the range be used up chunks are mapped anywhere.
+ */
+#define HEAP_RESERVE ((size_t) 1 << (sizeof(void *) > 4 ? 36 : 28))
+
+static void * __endHeap = 0;		/* End of the usable part of the range */
+static char * heapStart = NULL;
+static char * heapLimit = NULL;		/* End of the reserved range */
+
+/* heapReserve: Reserve the address range of the heap, starting at a huge
+ * page boundary. growLock is held */
+static void heapReserve(void)
+{
+	heapStart = mmap(NULL, HEAP_RESERVE + HUGEPAGE, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(heapStart == MAP_FAILED)
+	{
+		/* Map every chunk anywhere */
+		perror("failed to reserve heap");
+		heapStart = heapLimit = sbrk(0);
+	}
+	else
+	{
+		heapLimit = heapStart + HEAP_RESERVE + HUGEPAGE;
+		heapStart = (char *) ALIGNUP(heapStart, HUGEPAGE);
+	}
+	__endHeap = heapStart;
+}
 
 void * endHeap(void)
 {
+  void * end;
+
+  LOCK(&growLock);
   if(__endHeap == 0) 
   {
-  	__endHeap = sbrk(0);
+  	heapReserve();
   }
-  return __endHeap;
+  end = __endHeap;
+  UNLOCK(&growLock);
+  return end;
 }
 #endif
 
 
-static Header * morecore(unsigned int numUnits)
+static Header * morecore(Arena * a, unsigned int numUnits)
 {
 	void *cp;
 	Header *up;
-	char * newEnd = NULL;
 	
 	#ifdef MMAP
-		unsigned int numPages;
-		if(__endHeap == 0)
-		{
-			__endHeap = sbrk(0);
-		}
+		size_t length;
+		char *start;
 	#endif
 
+	/* Room for the fencepost and the unit lost to the offset of units */
+	numUnits += 2;
 	if(numUnits < NALLOC)
 	{
 		numUnits = NALLOC;
 	}
+	/* Chunks grow with the heap, so there are few searches that find no
+	 * block, which with first and next fit walk the whole list */
+	if(numUnits < a->heapBytes / HEAPGROWTH / sizeof(Header))
+	{
+		numUnits = a->heapBytes / HEAPGROWTH / sizeof(Header);
+	}
 	
+	LOCK(&growLock);
 	#ifdef MMAP
-		/* Number of pages = (number of units * header size - 1) / Size of page + 1) */
-		numPages = ((numUnits * sizeof(Header)) - 1) / getpagesize() + 1;
-		
-		/* Create a memory mapping starting that the end of the heap (if possible) 
-		 * with size equal to the number of pages * the page size 
-		 */
-		cp = mmap(__endHeap, 
-				numPages * getpagesize(), 
-				PROT_READ | PROT_WRITE, 
-				MAP_SHARED | MAP_ANONYMOUS, 
-				-1, 0);
-				
-		numUnits = (numPages * getpagesize()) / sizeof(Header);
-		newEnd = (char *)__endHeap;
-		newEnd += numPages * getpagesize();
-		__endHeap = (void *) newEnd;
+		if(__endHeap == 0)
+		{
+			heapReserve();
+		}
+
+		/* Whole pages, or whole huge pages at a huge page boundary */
+		start = __endHeap;
+		length = ALIGNUP((size_t) numUnits * sizeof(Header), getpagesize());
+		if(useHugePages())
+		{
+			start = (char *) ALIGNUP(start, HUGEPAGE);
+			length = ALIGNUP(length, HUGEPAGE);
+		}
+		numUnits = length / sizeof(Header);
+
+		if(start <= heapLimit && (size_t)(heapLimit - start) >= length &&
+		   mprotect(start, length, PROT_READ | PROT_WRITE) == 0)
+		{
+			if(hugePages)
+			{
+				adviseHugePages(start, length);
+			}
+			cp = start;
+			__endHeap = start + length;
+		}
+		else
+		{
+			cp = mmap(NULL, length, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		}
 	#else
 		cp = sbrk(numUnits * sizeof(Header));
 	#endif
+	UNLOCK(&growLock);
 	
 	/* no space at all */
 	if(cp == (void *) -1)
@@ -138,158 +804,2074 @@ static Header * morecore(unsigned int numUnits)
 		perror("failed to get more memory");
 		return NULL;
 	}
-	/* Set page size in the first header of the newly allocated block */
-	up = (Header *) cp;
-	up->s.size = numUnits;
-	free((void *)(up + 1));
-	return freep;
+	a->heapBytes += (size_t) numUnits * sizeof(Header);
+	/* Set page size in the first header of the newly allocated block,
+	 * a chunk right after the last one takes over its fencepost. Units
+	 * start HEADERSIZE bytes in, which leaves the last HEADERSIZE bytes
+	 * of a chunk unused */
+	up = (Header *)((char *) cp + HEADERSIZE);
+	if((char *)(a->fence + 1) + HEADERSIZE == (char *) cp)
+	{
+		up = a->fence;
+		up->s.size = numUnits;
+	}
+	else
+	{
+		up->s.size = numUnits - 2;
+		up->s.flags = (a - arenas) << ARENASHIFT;
+	}
+	a->fence = NEXTBLOCK(up);
+	a->fence->s.size = 1;
+	a->fence->s.flags = INUSE | ((a - arenas) << ARENASHIFT);
+	heapFree(a, up);
+
+	/* New memory is zero, but for the header and links of up */
+	a->cleanLo = up + MINUNITS;
+	a->cleanHi = a->fence;
+	return a->freep;
 }
-void * malloc(size_t nbytes)
+/* slabGrow: Make the next SLABSTEP bytes of the slab region usable, with
+ * room on the stack of empty slabs for all of them. growLock is held.
+ * Returns 0 on success */
+static int slabGrow(void)
 {
-	Header *p, *prevp;
-	Header * morecore(unsigned);
-	unsigned nunits;
+	size_t stack;
 
-	if(nbytes == 0) return NULL;
+	if(slabLimit >= slabRegion + SLABREGION) return -1;	/* Used up */
 
-	/* Calculate the number of units in ( Headers ) required 
-	 * to store the given amount of nbytes data */
-	nunits = (nbytes + sizeof(Header) - 1) / sizeof(Header) + 1;
+	stack = (slabLimit + SLABSTEP - slabRegion) / SLABSIZE * sizeof(Slab *);
+	if(mprotect(slabLimit, SLABSTEP, PROT_READ | PROT_WRITE) != 0 ||
+	   mprotect(emptySlabs, ALIGNUP(stack, getpagesize()), PROT_READ | PROT_WRITE) != 0)
+	{
+		return -1;
+	}
+	slabLimit += SLABSTEP;
+	return 0;
+}
 
-	/* Set previous pointer to point backwards next free block */
-	prevp = freep;
-	/* Nothing have yet been allocated, set everything to point to first element in list and size 
-	 * to 0 */	
-	if(prevp == NULL) 
-	{
-	  base.s.ptr = freep = prevp = &base;
-	  base.s.size = 0;
-	}
-
-	/* STRATEGY 1: First fit */
-	if(STRATEGY == 1){
-	  for(p= prevp->s.ptr;  ; prevp = p, p = p->s.ptr)
-	    {
-	      /* big enough */	
-	      if(p->s.size >= nunits)
-		{
-		  /* exactly */
-		  if (p->s.size == nunits)
-		    {                         
-		      prevp->s.ptr = p->s.ptr;
-		    }
-		  else 
-		    {
-		      /* allocate tail end */                                       
-		      p->s.size -= nunits;
-		      p += p->s.size;
-		      p->s.size = nunits;
-		    }
-		  
-		  freep = prevp;
-		  return (void *)(p+1);
-		}
-	      
-	      /* wrapped around free list */
-	      if(p == freep)
-		{                                     
-		  if((p = morecore(nunits)) == NULL)
-		    {
-		      return NULL;	/* none left */
-		    }
-		}
-	    }
+/* slabNew: Get an empty slab of class c for arena a */
+static Slab * slabNew(Arena * a, unsigned c)
+{
+	Slab *sp = NULL;
+	unsigned i;
+
+	LOCK(&growLock);
+	if(slabRegion == NULL)
+	{
+		/* The region, then the stack of empty slabs */
+		slabRegion = mmap(NULL, SLABREGION + HUGEPAGE + SLABREGION / SLABSIZE * sizeof(Slab *),
+				PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(slabRegion == MAP_FAILED)
+		{
+			perror("failed to reserve slab region");
+			slabRegion = NULL;
+		}
+		else
+		{
+			slabRegion = (char *) ALIGNUP(slabRegion, HUGEPAGE);
+			emptySlabs = (Slab **)(slabRegion + SLABREGION);
+			if(useHugePages())
+			{
+				adviseHugePages(slabRegion, SLABREGION);
+			}
+		}
+		slabTop = slabLimit = slabRegion;
 	}
-	
-	/* STRATEGY 2: Best fit */
-	else if(STRATEGY == 2){
-	  /* For saving the smallest block */
-	  Header *smallest = NULL;
-	  Header *smallestPrev = NULL;
-
-
-	  for(p= prevp->s.ptr;  ; prevp = p, p = p->s.ptr)
-	    {
-	      /* Scan for smallest block of size >= nunits */
-	      if(p->s.size >= nunits && 
-		 (smallest == NULL || p->s.size < smallest->s.size))
-		{
-		  /* Found one smaller than previous smallest */
-		  smallest = p;
-		  smallestPrev = prevp;
-		}
-	    
-
-	      /* Reached end of free list */
-	      if(p == freep)
-		{ 
-		  if(smallest != NULL){
-		    /* We've found a free big enough block, allocate it! */
-		    
-		    if (smallest->s.size == nunits)
-		      {                     
-			/* block fits exactly */
-			smallestPrev->s.ptr = smallest->s.ptr;
-		      }
-		    else 
-		      {
-			/* allocate tail end */                                       
-			smallest->s.size -= nunits;
-			smallest += smallest->s.size;
-			smallest->s.size = nunits;
-		      }
-		    
-		    freep = smallestPrev;
-		    return (void *)(smallest+1);
-		    
-		  }
-		  /* otherwise, get more memory */
-		  else if((p = morecore(nunits)) == NULL)
-		    {
-		      return NULL;	/* none left */
-		    }
-		}
-	    }
+	if(nempty > 0)
+	{
+		sp = emptySlabs[--nempty];
+		if(ntrimmed > nempty)
+		{
+			ntrimmed = nempty;
+		}
+	}
+	else if(slabRegion != NULL && (slabTop < slabLimit || slabGrow() == 0))
+	{
+		sp = (Slab *) slabTop;
+		slabTop += SLABSIZE;
+	}
+	UNLOCK(&growLock);
+
+	if(sp == NULL) return NULL;		/* Region used up */
+
+	sp->next = sp->prev = NULL;
+	sp->arena = a - arenas;
+	sp->size = (c + 1) * SLAB_QUANTUM;
+	sp->nslots = (SLABSIZE - SLAB_FIRST) / sp->size;
+	sp->nfree = sp->nslots;
+	memset(sp->freeMap, 0, sizeof(sp->freeMap));
+	for(i = 0; i < sp->nslots; i++)
+	{
+		sp->freeMap[i / BITSPERWORD] |= 1UL << (i % BITSPERWORD);
 	}
+	return sp;
 }
 
-void * realloc(void * oldBlock, size_t newSize)
+/* slabFree: Mark slab object ap free in its slab of arena a */
+static void slabFree(Arena * a, void * ap)
 {
-	void * newBlock = NULL;
-	Header * oldHeader = NULL;
-	size_t oldSize = 0;
-	
+	Slab *sp = SLABOF(ap);
+	unsigned c = sp->size / SLAB_QUANTUM - 1;
+	unsigned i = ((char *) ap - (char *) sp - SLAB_FIRST) / sp->size;
 
+	a->slab[c].frees++;
+	a->slab[c].inUse -= sp->size;
+	sp->freeMap[i / BITSPERWORD] |= 1UL << (i % BITSPERWORD);
 
-	if(oldBlock == NULL)
+	/* A full slab gets a free slot, put it back on the list */
+	if(sp->nfree++ == 0)
 	{
-		/* if oldBlock is NULL then we just allocate as normal */
-		return malloc(newSize);
+		sp->prev = NULL;
+		sp->next = a->partial[c];
+		if(sp->next != NULL)
+		{
+			sp->next->prev = sp;
+		}
+		a->partial[c] = sp;
 	}
-	else if(newSize == 0)
+
+	/* An empty slab is given back unless it is the last of its class */
+	if(sp->nfree == sp->nslots && (sp->prev != NULL || sp->next != NULL))
 	{
-		/* newSize is zero which means that no data will be moved to 
-		 * the new block (free the old block) */
-		free(oldBlock);
-		return NULL;
+		if(sp->prev != NULL)
+		{
+			sp->prev->next = sp->next;
+		}
+		else
+		{
+			a->partial[c] = sp->next;
+		}
+		if(sp->next != NULL)
+		{
+			sp->next->prev = sp->prev;
+		}
+
+		LOCK(&growLock);
+		emptySlabs[nempty++] = sp;
+		UNLOCK(&growLock);
 	}
-	else
+}
+
+/* blockSize: Number of bytes the caller may use in block ap */
+static size_t blockSize(void * ap)
+{
+	if(ISSLAB(ap))
+	{
+		return SLABOF(ap)->size;
+	}
+	if(BLOCKOF(ap)->s.flags & MAPPED)
+	{
+		return (BLOCKOF(ap)->s.size - 1) * sizeof(Header);
+	}
+	return BLOCKOF(ap)->s.size * sizeof(Header) - HEADERSIZE;
+}
+
+/* bigAlloc: Map a block of its own for a request of nbytes bytes. The
+ * header is HEADERSIZE bytes into the mapping, its size counts the whole
+ * mapping */
+static Header * bigAlloc(size_t nbytes)
+{
+	size_t length = (nbytes + sizeof(Header) + getpagesize() - 1) & ~(size_t)(getpagesize() - 1);
+	Header *bp;
+	char *cp;
+
+	/* The size in units must fit in the header */
+	if(length < nbytes || length / sizeof(Header) > (unsigned) -1) return NULL;
+
+	cp = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(cp == MAP_FAILED) return NULL;
+
+	bp = (Header *)(cp + HEADERSIZE);
+	bp->s.size = length / sizeof(Header);
+	bp->s.flags = INUSE | MAPPED;
+	STATADD(mappedBlocks, 1);
+	STATADD(mappedBytes, length);
+	return bp;
+}
+
+/* bigFree: Unmap a block from bigAlloc() */
+static void bigFree(Header * bp)
+{
+	STATADD(mappedBlocks, -1);
+	STATADD(mappedBytes, -(size_t) bp->s.size * sizeof(Header));
+	munmap((char *) bp - HEADERSIZE, (size_t) bp->s.size * sizeof(Header));
+}
+
+/* bigRealloc: Resize a block from bigAlloc() to hold nbytes bytes by
+ * remapping its pages, the data is never copied. Returns NULL if the
+ * mapping can not be resized */
+static Header * bigRealloc(Header * bp, size_t nbytes)
+{
+#ifdef MREMAP_MAYMOVE
+	size_t length = (nbytes + sizeof(Header) + getpagesize() - 1) & ~(size_t)(getpagesize() - 1);
+	Header *np;
+	char *cp;
+
+	if(length < nbytes || length / sizeof(Header) > (unsigned) -1) return NULL;
+
+	cp = mremap((char *) bp - HEADERSIZE, (size_t) bp->s.size * sizeof(Header),
+			length, MREMAP_MAYMOVE);
+	if(cp == MAP_FAILED) return NULL;
+
+	np = (Header *)(cp + HEADERSIZE);
+	STATADD(mappedBytes, length - (size_t) np->s.size * sizeof(Header));
+	np->s.size = length / sizeof(Header);
+	return np;
+#else
+	return NULL;
+#endif
+}
+
+#ifdef THREADS
+/* remotePush: Queue block ap for its arena a without taking its lock */
+static void remotePush(Arena * a, void * ap)
+{
+	void *head;
+
+	do
+	{
+		head = a->remote;
+		*(void **) ap = head;
+	} while(!__sync_bool_compare_and_swap(&a->remote, head, ap));
+}
+
+/* remoteDrain: Free every block queued for arena a, a must be locked */
+static void remoteDrain(Arena * a)
+{
+	void *ap, *next;
+
+	for(ap = __sync_lock_test_and_set(&a->remote, NULL); ap != NULL; ap = next)
+	{
+		next = *(void **) ap;
+		if(ISSLAB(ap))
+		{
+			slabFree(a, ap);
+		}
+		else
+		{
+			a->heap.frees++;
+			a->heap.inUse -= BLOCKOF(ap)->s.size * sizeof(Header);
+			heapFree(a, BLOCKOF(ap));
+		}
+	}
+}
+#endif
+
+/* slabAlloc: Take a free slot of class c from arena a, or NULL if the
+ * slab region is used up */
+static void * slabAlloc(Arena * a, unsigned c)
+{
+	Slab *sp;
+	unsigned w, i;
+
+#ifdef THREADS
+	if(a->remote != NULL)
+	{
+		remoteDrain(a);
+	}
+#endif
+	sp = a->partial[c];
+	if(sp == NULL)
+	{
+		if((sp = slabNew(a, c)) == NULL) return NULL;
+		a->partial[c] = sp;
+	}
+
+	for(w = 0; sp->freeMap[w] == 0; w++)
+		;
+	i = w * BITSPERWORD + __builtin_ctzl(sp->freeMap[w]);
+	sp->freeMap[w] &= ~(1UL << (i % BITSPERWORD));
+
+	/* A full slab leaves the list */
+	if(--sp->nfree == 0)
+	{
+		a->partial[c] = sp->next;
+		if(sp->next != NULL)
+		{
+			sp->next->prev = NULL;
+		}
+	}
+	a->slab[c].allocs++;
+	a->slab[c].inUse += sp->size;
+	return (char *) sp + SLAB_FIRST + i * sp->size;
+}
+
+/* firstFit: STRATEGY 1, the first block that fits from the head of the
+ * list. The last block of the heap counts as the head, as if every new
+ * chunk went to the front of the list */
+static Header * firstFit(Arena * a, unsigned nunits)
+{
+	Header *p;
+
+	if(a->fence != NULL && (a->fence->s.flags & PREVFREE) &&
+	   (p = PREVBLOCK(a->fence))->s.size >= nunits)
+	{
+		return split(a, p, nunits);
+	}
+	for(p = a->base->s.ptr; ; p = p->s.ptr)
+	{
+		/* big enough */
+		if(p->s.size >= nunits)
+		{
+			return split(a, p, nunits);
+		}
+
+		/* wrapped around free list, the new block follows the one
+		 * morecore() returns */
+		if(p == a->base)
+		{
+			if((p = morecore(a, nunits)) == NULL)
+			{
+				return NULL;	/* none left */
+			}
+		}
+	}
+}
+
+/* nextFit: STRATEGY 4, the search goes on where the last one ended */
+static Header * nextFit(Arena * a, unsigned nunits)
+{
+	Header *p;
+
+	for(p = a->freep->s.ptr; ; p = p->s.ptr)
+	{
+		/* big enough */
+		if(p->s.size >= nunits)
+		{
+			a->freep = PREVP(p);
+			return split(a, p, nunits);
+		}
+
+		/* wrapped around free list */
+		if(p == a->freep)
+		{
+			if((p = morecore(a, nunits)) == NULL)
+			{
+				return NULL;	/* none left */
+			}
+		}
+	}
+}
+
+/* bestFit: STRATEGY 2, the smallest block that fits */
+static Header * bestFit(Arena * a, unsigned nunits)
+{
+	Header *p;
+	unsigned c = sizeClass(nunits);
+	int next;
+
+	for( ; ; )
+	{
+		/* Smallest fitting block of the own class, otherwise the
+		 * smallest block of the next non-empty class */
+		p = (c < NEXACT) ? a->classList[c] : treeFit(a->classList[c], nunits);
+		if(p == NULL && (next = nextClass(a, c + 1)) >= 0)
+		{
+			p = a->classList[next];
+			if(next >= NEXACT)
+			{
+				while(LEFT(p) != NULL) p = LEFT(p);
+			}
+		}
+
+		if(p != NULL)
+		{
+			return split(a, p, nunits);
+		}
+
+		/* Nothing fits, get more memory */
+		if(morecore(a, nunits) == NULL)
+		{
+			return NULL;	/* none left */
+		}
+	}
+}
+
+/* worstFit: STRATEGY 5, the largest block if even that one fits */
+static Header * worstFit(Arena * a, unsigned nunits)
+{
+	Header *p;
+	int last;
+
+	for( ; ; )
+	{
+		if((last = lastClass(a)) >= 0)
+		{
+			p = a->classList[last];
+			if(last >= NEXACT)
+			{
+				while(RIGHT(p) != NULL) p = RIGHT(p);
+			}
+			if(p->s.size >= nunits)
+			{
+				return split(a, p, nunits);
+			}
+		}
+
+		/* Nothing fits, get more memory */
+		if(morecore(a, nunits) == NULL)
+		{
+			return NULL;	/* none left */
+		}
+	}
+}
+
+/* segregatedFit: STRATEGY 3, the first block of the own class if it
+ * fits, otherwise any block of a larger class (all of them fit) */
+static Header * segregatedFit(Arena * a, unsigned nunits)
+{
+	Header *p;
+	unsigned c = sizeClass(nunits);
+	int next;
+
+	for( ; ; )
+	{
+		p = a->classList[c];
+		if(p == NULL || p->s.size < nunits)
+		{
+			next = nextClass(a, c + 1);
+			p = (next < 0) ? NULL : a->classList[next];
+		}
+
+		if(p != NULL)
+		{
+			return split(a, p, nunits);
+		}
+
+		/* Nothing fits, get more memory */
+		if(morecore(a, nunits) == NULL)
+		{
+			return NULL;	/* none left */
+		}
+	}
+}
+
+static Header * chooseFit(Arena *, unsigned);
+
+/* Search of the strategy, chooseFit() until the heap is first used */
+static Header * (*fit)(Arena *, unsigned) = chooseFit;
+
+/* strategyInit: Read the strategy from the environment */
+static void strategyInit(void)
+{
+	static const char *names[] = {"first", "best", "segregated", "next", "worst"};
+	static Header * (*fits[])(Arena *, unsigned) =
+		{firstFit, bestFit, segregatedFit, nextFit, worstFit};
+	char *env;
+	int i;
+
+	LOCK(&growLock);
+	if(fit == chooseFit)
+	{
+		env = getenv("MALLOC_STRATEGY");
+		for(i = 0; env != NULL && i < 5; i++)
+		{
+			if(atoi(env) == i + 1 || strcmp(env, names[i]) == 0)
+			{
+				strategy = i + 1;
+			}
+		}
+		sizeTrees = (strategy == 2 || strategy == 5);
+		sizeClasses = (sizeTrees || strategy == 3);
+		/* The flags must be seen before the new search */
+		__sync_synchronize();
+		fit = fits[strategy - 1];
+	}
+	UNLOCK(&growLock);
+}
+
+/* chooseFit: Pick the strategy, then search with it */
+static Header * chooseFit(Arena * a, unsigned nunits)
+{
+	strategyInit();
+	return fit(a, nunits);
+}
+
+/* heapReady: Get arena a ready for a search of its free blocks */
+static void heapReady(Arena * a)
+{
+#ifdef THREADS
+	if(a->remote != NULL)
+	{
+		remoteDrain(a);
+	}
+#endif
+
+	/* Nothing have yet been allocated, set everything to point to first element in list and size 
+	 * to 0 */	
+	if(a->freep == NULL) 
+	{
+	  a->base->s.ptr = PREVP(a->base) = a->freep = a->base;
+	  a->base->s.size = 0;
+	}
+}
+
+/* heapAlloc: Take a block of at least nunits units from arena a */
+static Header * heapAlloc(Arena * a, unsigned nunits)
+{
+	Header *p;
+
+	heapReady(a);
+	if((p = fit(a, nunits)) != NULL)
+	{
+		a->heap.allocs++;
+		a->heap.inUse += p->s.size * sizeof(Header);
+	}
+	return p;
+}
+
+static void shrinkBlock(Arena *, Header *, unsigned);
+
+/* alignedStart: Where a block of nunits units with its data aligned to
+ * align starts in free block p, or NULL if it does not fit. A part in
+ * front must be large enough to stay in the free list */
+static Header * alignedStart(Header * p, unsigned nunits, size_t align)
+{
+	unsigned long h = (unsigned long) p;
+
+	if((h + HEADERSIZE) & (align - 1))
+	{
+		h = ALIGNUP((char *)(p + MINUNITS) + HEADERSIZE, align) - HEADERSIZE;
+	}
+	if(h + (unsigned long) nunits * sizeof(Header) > (unsigned long) NEXTBLOCK(p))
+	{
+		return NULL;
+	}
+	return (Header *) h;
+}
+
+/* treeAligned: First block in the tree at p that an aligned block fits in */
+static Header * treeAligned(Header * p, unsigned nunits, size_t align)
+{
+	Header *found;
+
+	while(p != NULL)
+	{
+		/* Every block on the left is smaller */
+		if(p->s.size >= nunits)
+		{
+			if((found = treeAligned(LEFT(p), nunits, align)) != NULL) return found;
+			if(alignedStart(p, nunits, align) != NULL) return p;
+		}
+		p = RIGHT(p);
+	}
+	return NULL;
+}
+
+/* alignedFit: Free block of arena a that an aligned block fits in */
+static Header * alignedFit(Arena * a, unsigned nunits, size_t align)
+{
+	Header *p;
+	int c;
+
+	if(!sizeClasses)
+	{
+		for(p = a->base->s.ptr; p != a->base; p = p->s.ptr)
+		{
+			if(alignedStart(p, nunits, align) != NULL) return p;
+		}
+		return NULL;
+	}
+	for(c = nextClass(a, sizeClass(nunits)); c >= 0; c = nextClass(a, c + 1))
+	{
+		if(sizeTrees && c >= NEXACT)
+		{
+			if((p = treeAligned(a->classList[c], nunits, align)) != NULL) return p;
+			continue;
+		}
+		for(p = a->classList[c]; p != NULL; p = p->s.ptr)
+		{
+			if(alignedStart(p, nunits, align) != NULL) return p;
+		}
+	}
+	return NULL;
+}
+
+/* heapAligned: Carve a block of nunits units with its data aligned to
+ * align out of a free block of arena a. The part in front of it and the
+ * tail go back to the free list */
+static Header * heapAligned(Arena * a, unsigned nunits, size_t align)
+{
+	Header *p, *bp, *end;
+	unsigned arenaBits;
+
+	heapReady(a);
+	while((p = alignedFit(a, nunits, align)) == NULL)
+	{
+		/* Any new block this large has room for it */
+		if(morecore(a, nunits + align / sizeof(Header) + MINUNITS) == NULL)
+		{
+			return NULL;	/* none left */
+		}
+	}
+
+	bp = alignedStart(p, nunits, align);
+	arenaBits = p->s.flags & ~(INUSE | PREVFREE);
+	listRemove(a, p);
+	p->s.flags |= INUSE;
+	NEXTBLOCK(p)->s.flags &= ~PREVFREE;
+	if(bp != p)
+	{
+		bp->s.size = p->s.size - (bp - p);
+		bp->s.flags = INUSE | arenaBits;
+		p->s.size = bp - p;
+		heapFree(a, p);
+	}
+	/* Take in a gap too small to be listed before the next block of this
+	 * alignment could start, so a run of them packs without one */
+	end = (Header *)(ALIGNUP((char *)(bp + nunits) + HEADERSIZE, align) - HEADERSIZE);
+	if(end - (bp + nunits) < MINUNITS && end <= NEXTBLOCK(bp))
+	{
+		nunits = end - bp;
+	}
+	shrinkBlock(a, bp, nunits);
+	cleanUse(a, bp);
+	a->heap.allocs++;
+	a->heap.inUse += bp->s.size * sizeof(Header);
+	return bp;
+}
+
+/* trimBlock: Release the whole pages inside free block bp, sparing its
+ * header, list link and footer. Returns 1 if any page was released */
+static int trimBlock(Header * bp)
+{
+	unsigned long page = getpagesize();
+	unsigned long start = ((unsigned long)(bp + MINUNITS) + page - 1) & ~(page - 1);
+	unsigned long end = (unsigned long) FOOTER(bp) & ~(page - 1);
+
+	if(start >= end) return 0;
+
+	madvise((void *) start, end - start, MADV_DONTNEED);
+	return 1;
+}
+
+/* treeTrim: Release the pages inside the large blocks of a best fit tree */
+static int treeTrim(Header * p)
+{
+	int released = 0;
+
+	while(p != NULL)
+	{
+		released |= treeTrim(LEFT(p));
+		if(p->s.size >= TRIM_MINBLOCK / sizeof(Header))
+		{
+			released |= trimBlock(p);
+		}
+		p = RIGHT(p);
+	}
+	return released;
+}
+
+/* trimTop: Unmap the free end of the last chunk of arena a, keeping pad
+ * bytes. Returns 1 if anything was unmapped */
+static int trimTop(Arena * a, size_t pad)
+{
+#ifdef MMAP
+	unsigned long page = getpagesize();
+	Header *top;
+	char *cut, *end;
+
+	if(a->fence == NULL || !(a->fence->s.flags & PREVFREE)) return 0;
+
+	/* Keep the top block listable and room for the new fencepost */
+	top = PREVBLOCK(a->fence);
+	end = (char *)(a->fence + 1) + HEADERSIZE;
+	cut = (char *)(top + MINUNITS + 1) + HEADERSIZE + pad;
+	cut = (char *)(((unsigned long) cut + page - 1) & ~(page - 1));
+	if(cut >= end) return 0;
+
+	listRemove(a, top);
+	a->fence = (Header *)(cut - HEADERSIZE) - 1;
+	a->fence->s.size = 1;
+	a->fence->s.flags = INUSE | PREVFREE | (top->s.flags & ~(INUSE | PREVFREE));
+	top->s.size = a->fence - top;
+	FOOTER(top)->s.size = top->s.size;
+	listInsert(a, top);
+	if(a->cleanHi > a->fence)
+	{
+		a->cleanHi = a->fence;
+	}
+	a->heapBytes -= end - cut;
+
+	LOCK(&growLock);
+	if(cut >= heapStart && end <= heapLimit)
+	{
+		/* Hand the pages back but keep the range reserved */
+		mmap(cut, end - cut, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+		if(__endHeap == end)
+		{
+			/* Let the next chunk take its place */
+			__endHeap = cut;
+		}
+	}
+	else
+	{
+		munmap(cut, end - cut);
+	}
+	UNLOCK(&growLock);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* arenaTrim: Give the free memory of arena a back to the system, keeping
+ * pad bytes at the end of the heap. a must be locked */
+static int arenaTrim(Arena * a, size_t pad)
+{
+	Header *p;
+	unsigned c;
+	int released;
+
+#ifdef THREADS
+	if(a->remote != NULL)
+	{
+		remoteDrain(a);
+	}
+#endif
+	a->untrimmed = 0;
+	if(a->freep == NULL) return 0;		/* Never used */
+
+	released = trimTop(a, pad);
+	if(sizeTrees)
+	{
+		for(c = sizeClass(TRIM_MINBLOCK / sizeof(Header)); c < NCLASSES; c++)
+		{
+			released |= treeTrim(a->classList[c]);
+		}
+	}
+	else if(sizeClasses)
+	{
+		for(c = sizeClass(TRIM_MINBLOCK / sizeof(Header)); c < NCLASSES; c++)
+		{
+			for(p = a->classList[c]; p != NULL; p = p->s.ptr)
+			{
+				if(p->s.size >= TRIM_MINBLOCK / sizeof(Header))
+				{
+					released |= trimBlock(p);
+				}
+			}
+		}
+	}
+	else
+	{
+		for(p = a->base->s.ptr; p != a->base; p = p->s.ptr)
+		{
+			if(p->s.size >= TRIM_MINBLOCK / sizeof(Header))
+			{
+				released |= trimBlock(p);
+			}
+		}
+	}
+	return released;
+}
+
+/* slabTrim: Release the pages of empty slabs. Returns 1 if any */
+static int slabTrim(void)
+{
+	int released = 0;
+
+	LOCK(&growLock);
+	for( ; ntrimmed < nempty; ntrimmed++)
+	{
+		madvise(emptySlabs[ntrimmed], SLABSIZE, MADV_DONTNEED);
+		released = 1;
+	}
+	UNLOCK(&growLock);
+	return released;
+}
+
+#ifdef THREADS
+/* forkPrepare: Take every lock so the child of fork() gets the heap in a
+ * consistent state, forkParent releases them again in both processes */
+static void forkPrepare(void)
+{
+	unsigned i;
+
+	for(i = 0; i < narenas; i++)
+	{
+		pthread_mutex_lock(&arenas[i].lock);
+	}
+	pthread_mutex_lock(&growLock);
+	pthread_mutex_lock(&profileLock);
+}
+
+static void forkParent(void)
+{
+	unsigned i;
+
+	pthread_mutex_unlock(&profileLock);
+	pthread_mutex_unlock(&growLock);
+	for(i = narenas; i-- > 0; )
+	{
+		pthread_mutex_unlock(&arenas[i].lock);
+	}
+}
+
+/* arenaInit: Read the number of arenas and set up their locks */
+static void arenaInit(void)
+{
+	char *env = getenv("MALLOC_ARENAS");
+	long n = (env != NULL) ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned i;
+
+	narenas = (n < 1) ? 1 : (n > MAXARENAS) ? MAXARENAS : n;
+	for(i = 0; i < narenas; i++)
+	{
+		pthread_mutex_init(&arenas[i].lock, NULL);
+	}
+	pthread_key_create(&tcacheKey, tcacheExit);
+	pthread_atfork(forkPrepare, forkParent, forkParent);
+}
+
+/* tcacheFlush: Give the count first objects of cache list c back to
+ * their slabs */
+static void tcacheFlush(unsigned c, unsigned count)
+{
+	void *ap;
+
+	LOCK(&tcache.arena->lock);
+	for( ; count > 0 && tcache.list[c] != NULL; count--)
+	{
+		ap = tcache.list[c];
+		tcache.list[c] = *(void **) ap;
+		tcache.count[c]--;
+		slabFree(tcache.arena, ap);
+	}
+	UNLOCK(&tcache.arena->lock);
+}
+
+/* tcacheExit: Empty the cache of an exiting thread */
+static void tcacheExit(void * unused)
+{
+	unsigned c;
+
+	for(c = 0; c < SLAB_CLASSES; c++)
+	{
+		tcacheFlush(c, tcache.count[c]);
+	}
+	/* Anything freed from now on goes straight to the heap */
+	tcache.state = TCACHE_DEAD;
+}
+
+/* tcacheStart: Give a new thread its arena and make sure the cache is
+ * flushed when the thread exits. Returns 0 if the thread is exiting and
+ * must not use its cache */
+static int tcacheStart(void)
+{
+	if(tcache.state == TCACHE_UNUSED)
+	{
+		pthread_once(&arenaOnce, arenaInit);
+		tcache.arena = &arenas[__sync_fetch_and_add(&nextArena, 1) % narenas];
+		pthread_setspecific(tcacheKey, &tcache);
+		tcache.state = TCACHE_ACTIVE;
+		if(!statsReady)
+		{
+			statsInit();
+		}
+	}
+	return tcache.state == TCACHE_ACTIVE;
+}
+
+/* tcacheGet: Take an object of slab class c from the cache, refilling it
+ * from the slabs with a batch of objects when empty */
+static void * tcacheGet(unsigned c)
+{
+	void *ap;
+	int n;
+
+	if(tcache.list[c] == NULL)
+	{
+		if(!tcacheStart()) return NULL;
+
+		LOCK(&tcache.arena->lock);
+		for(n = 0; n < TCACHE_BATCH && (ap = slabAlloc(tcache.arena, c)) != NULL; n++)
+		{
+			*(void **) ap = tcache.list[c];
+			tcache.list[c] = ap;
+			tcache.count[c]++;
+		}
+		UNLOCK(&tcache.arena->lock);
+		if(n == 0) return NULL;
+	}
+	ap = tcache.list[c];
+	tcache.list[c] = *(void **) ap;
+	tcache.count[c]--;
+	return ap;
+}
+
+/* tcachePut: Keep slab object ap of the thread's arena in the cache,
+ * giving a batch of objects back when the cache grows too large.
+ * Returns 0 if not cached */
+static int tcachePut(void * ap)
+{
+	Slab *sp = SLABOF(ap);
+	unsigned c = sp->size / SLAB_QUANTUM - 1;
+
+	if(!tcacheStart()) return 0;
+
+	*(void **) ap = tcache.list[c];
+	tcache.list[c] = ap;
+	if(++tcache.count[c] > TCACHE_LIMIT)
+	{
+		tcacheFlush(c, TCACHE_BATCH);
+	}
+	return 1;
+}
+#endif
+
+/* threadArena: The arena the calling thread allocates from */
+static Arena * threadArena(void)
+{
+#ifdef THREADS
+	tcacheStart();
+	return tcache.arena;
+#else
+	if(!statsReady)
+	{
+		statsInit();
+	}
+	return arenas;
+#endif
+}
+
+/* Sampling profiler
+ *
+ * With MALLOC_SAMPLE=<bytes> in the environment, one allocation in about
+ * every that many bytes allocated is sampled: its call stack is recorded
+ * in a table of live samples until it is freed. The distance to the next
+ * sample is drawn from an exponential distribution, so the samples form
+ * a Poisson process over the bytes allocated and large blocks are more
+ * likely to be picked than small ones. Each thread counts its bytes down
+ * on its own, a request that is not sampled costs one subtraction.
+ *
+ * A sampled block always has a Header, small requests are taken from the
+ * heap instead of a slab, so free() recognises it by its SAMPLED flag and
+ * blocks that were never sampled are not looked up. Blocks from
+ * memalign() and friends are not sampled.
+ *
+ * malloc_profile_dump() writes the live samples as a heap profile pprof
+ * reads, as does the exit of the program when MALLOC_PROFILE=<file> is
+ * set as well.
+ */
+#define PROFILE_DEPTH 32		/* Most frames of a call stack */
+#define PROFILE_BUCKETS 4096	/* Hash table of the live samples */
+#define PROFILE_POOL (64 * 1024)	/* Bytes of samples mapped at once */
+#define PROFILE_HASH(ap) (((unsigned long)(ap) >> 4) % PROFILE_BUCKETS)
+
+typedef struct sample
+{
+	struct sample *next;		/* Next in bucket or unused */
+	void *ap;
+	size_t size;				/* Bytes requested */
+	int depth;
+	void *stack[PROFILE_DEPTH];
+} Sample;
+
+static long sampleRate = -1;	/* Mean bytes between samples, 0 if off */
+static Sample *sampleTable[PROFILE_BUCKETS];
+static Sample *unusedSamples = NULL;
+static size_t liveSamples = 0;
+static size_t liveBytes = 0;
+
+#ifdef THREADS
+static __thread long sampleLeft = 0;		/* Bytes until the next sample */
+static __thread unsigned long sampleSeed = 0;
+static __thread int inProfile = 0;			/* Allocations are not sampled */
+#else
+static long sampleLeft = 0;
+static unsigned long sampleSeed = 0;
+static int inProfile = 0;
+#endif
+
+/* SAMPLING: Count nbytes down, true if the request is to be sampled */
+#define SAMPLING(nbytes) ((sampleLeft -= (long)(nbytes)) < 0)
+
+static void profileExit(void);
+
+/* profileInit: Read the sampling rate from the environment. atexit() may
+ * allocate, so it is called without profileLock */
+static void profileInit(void)
+{
+	char *env;
+	long rate;
+	int dump = 0;
+
+	LOCK(&profileLock);
+	if(sampleRate < 0)
+	{
+		env = getenv("MALLOC_SAMPLE");
+		rate = (env != NULL) ? atol(env) : 0;
+		dump = (rate > 0 && getenv("MALLOC_PROFILE") != NULL);
+		sampleRate = (rate > 0) ? rate : 0;
+	}
+	UNLOCK(&profileLock);
+	if(dump)
+	{
+		atexit(profileExit);
+	}
+}
+
+/* sampleInterval: Bytes to the next sample, -ln(u) * sampleRate for u
+ * uniform in (0, 1]. The logarithm is taken of the exponent and of the
+ * mantissa by a short series, so libm is not needed */
+static long sampleInterval(void)
+{
+	unsigned long x;
+	double m, t, t2, ln;
+	int e;
+
+	if(sampleSeed == 0)
+	{
+		sampleSeed = (unsigned long) &sampleLeft ^ ((unsigned long) getpid() << 16) ^ 1;
+	}
+	/* xorshift */
+	sampleSeed ^= sampleSeed << 13;
+	sampleSeed ^= sampleSeed >> 7;
+	sampleSeed ^= sampleSeed << 17;
+
+	x = sampleSeed | 1;
+	e = BITSPERWORD - 1 - __builtin_clzl(x);
+	m = (double) x / (double)(1UL << e);	/* In [1, 2) */
+	t = (m - 1) / (m + 1);
+	t2 = t * t;
+	ln = (double)((int) e - (int) BITSPERWORD) * 0.69314718055994531 +
+		2 * t * (1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 + t2 / 9))));
+	return (long)(-ln * sampleRate) + 1;
+}
+
+/* profileAdd: Record sampled block ap of size bytes with its call stack */
+static void profileAdd(void * ap, size_t size, void ** stack, int depth)
+{
+	Sample *sp;
+	size_t i;
+
+	LOCK(&profileLock);
+	if(unusedSamples == NULL)
+	{
+		sp = mmap(NULL, PROFILE_POOL, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(sp == MAP_FAILED)
+		{
+			UNLOCK(&profileLock);
+			return;
+		}
+		for(i = 0; i < PROFILE_POOL / sizeof(Sample); i++)
+		{
+			sp[i].next = unusedSamples;
+			unusedSamples = &sp[i];
+		}
+	}
+	sp = unusedSamples;
+	unusedSamples = sp->next;
+
+	sp->ap = ap;
+	sp->size = size;
+	sp->depth = depth;
+	memcpy(sp->stack, stack, depth * sizeof(void *));
+	sp->next = sampleTable[PROFILE_HASH(ap)];
+	sampleTable[PROFILE_HASH(ap)] = sp;
+	liveSamples++;
+	liveBytes += size;
+	UNLOCK(&profileLock);
+}
+
+/* profileFind: Where the table points to the sample of block ap,
+ * profileLock is held */
+static Sample ** profileFind(void * ap)
+{
+	Sample **spp = &sampleTable[PROFILE_HASH(ap)];
+
+	while(*spp != NULL && (*spp)->ap != ap)
+	{
+		spp = &(*spp)->next;
+	}
+	return spp;
+}
+
+/* profileFree: Forget the sample of block ap, which is being freed. Its
+ * SAMPLED flag is cleared by heapFree(), under the lock of the arena */
+static void profileFree(void * ap)
+{
+	Sample **spp, *sp;
+
+	LOCK(&profileLock);
+	spp = profileFind(ap);
+	if((sp = *spp) != NULL)
+	{
+		*spp = sp->next;
+		liveSamples--;
+		liveBytes -= sp->size;
+		sp->next = unusedSamples;
+		unusedSamples = sp;
+	}
+	UNLOCK(&profileLock);
+}
+
+/* profileMove: Sampled block ap was resized to size bytes at np */
+static void profileMove(void * ap, void * np, size_t size)
+{
+	Sample **spp, *sp;
+
+	LOCK(&profileLock);
+	spp = profileFind(ap);
+	if((sp = *spp) != NULL)
+	{
+		*spp = sp->next;
+		liveBytes += size - sp->size;
+		sp->ap = np;
+		sp->size = size;
+		sp->next = sampleTable[PROFILE_HASH(np)];
+		sampleTable[PROFILE_HASH(np)] = sp;
+	}
+	UNLOCK(&profileLock);
+}
+
+/* profileAlloc: Allocate nbytes bytes as a sampled block, called when the
+ * count down of the thread has run out. Returns NULL if the request is
+ * not to be sampled after all, or can not be satisfied. Not inlined, so
+ * the stack of the caller always starts two frames up */
+static void * __attribute__((noinline)) profileAlloc(size_t nbytes)
+{
+	void *stack[PROFILE_DEPTH + 2];
+	Arena *a;
+	Header *p;
+	int depth;
+
+	/* backtrace() may allocate, and stdio while dumping the profile */
+	if(inProfile) return NULL;
+	if(sampleRate < 0)
+	{
+		profileInit();
+	}
+	if(sampleRate == 0)
+	{
+		sampleLeft = LONG_MAX;
+		return NULL;
+	}
+	sampleLeft = sampleInterval();
+
+	/* The flags share their word with PREVFREE, which the arena changes
+	 * under its lock */
+	if(nbytes >= MMAP_THRESHOLD)
+	{
+		if((p = bigAlloc(nbytes)) != NULL)
+		{
+			p->s.flags |= SAMPLED;
+		}
+	}
+	else
+	{
+		a = threadArena();
+		LOCK(&a->lock);
+		if((p = heapAlloc(a, NUNITS(nbytes))) != NULL)
+		{
+			p->s.flags |= SAMPLED;
+		}
+		UNLOCK(&a->lock);
+	}
+	if(p == NULL) return NULL;
+
+	inProfile = 1;
+	depth = backtrace(stack, PROFILE_DEPTH + 2);
+	inProfile = 0;
+	/* Leave out profileAlloc() and the malloc() calling it */
+	depth = (depth > 2) ? depth - 2 : 0;
+	profileAdd(DATA(p), nbytes, stack + 2, depth);
+	return DATA(p);
+}
+
+/* profileWrite: Write the live samples to f in the heap profile format
+ * of pprof. stdio may allocate and so take an arena lock, which must not
+ * happen under profileLock (see forkPrepare()), so the samples are copied
+ * out first. Returns -1 if there was no memory for the copy */
+static int profileWrite(FILE * f)
+{
+	char buf[4096];
+	Sample *sp, *copy;
+	size_t count, bytes, length, s = 0;
+	int fd, n, i, b;
+
+	LOCK(&profileLock);
+	count = liveSamples;
+	bytes = liveBytes;
+	length = (count + 1) * sizeof(Sample);
+	copy = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(copy != MAP_FAILED)
+	{
+		for(b = 0; b < PROFILE_BUCKETS; b++)
+		{
+			for(sp = sampleTable[b]; sp != NULL; sp = sp->next)
+			{
+				copy[s++] = *sp;
+			}
+		}
+	}
+	UNLOCK(&profileLock);
+	if(copy == MAP_FAILED) return -1;
+
+	fprintf(f, "heap profile: %lu: %lu [ %lu: %lu] @ heap_v2/%ld\n",
+		(unsigned long) count, (unsigned long) bytes,
+		(unsigned long) count, (unsigned long) bytes, sampleRate);
+	for(sp = copy; sp < copy + s; sp++)
+	{
+		fprintf(f, "1: %lu [1: %lu] @", (unsigned long) sp->size,
+			(unsigned long) sp->size);
+		for(i = 0; i < sp->depth; i++)
+		{
+			fprintf(f, " %p", sp->stack[i]);
+		}
+		fputc('\n', f);
+	}
+	munmap(copy, length);
+
+	/* pprof finds the symbols through the mappings */
+	fputs("\nMAPPED_LIBRARIES:\n", f);
+	if((fd = open("/proc/self/maps", O_RDONLY)) >= 0)
+	{
+		while((n = read(fd, buf, sizeof(buf))) > 0)
+		{
+			fwrite(buf, 1, n, f);
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+/* malloc_profile_dump: Write the live samples to file as a heap profile
+ * for pprof. Returns 0, or -1 if the file could not be written */
+int malloc_profile_dump(const char * file)
+{
+	FILE *f;
+	int failed;
+
+	inProfile = 1;
+	f = fopen(file, "w");
+	if(f == NULL)
+	{
+		inProfile = 0;
+		return -1;
+	}
+	failed = profileWrite(f);
+	failed |= ferror(f);
+	failed |= fclose(f);
+	inProfile = 0;
+	return failed ? -1 : 0;
+}
+
+/* profileExit: Dump the profile to the file named by MALLOC_PROFILE */
+static void profileExit(void)
+{
+	if(malloc_profile_dump(getenv("MALLOC_PROFILE")) != 0)
+	{
+		perror("failed to write malloc profile");
+	}
+}
+
+/* Tracing
+ *
+ * With MALLOC_TRACE=<file> every public call is logged, see trace.h.
+ * Calls made inside the allocator, e.g. malloc() by realloc(), are not.
+ * Each thread is numbered in the order of its first logged call. A
+ * record slot is claimed with an atomic add on the count in the file, so
+ * threads never wait for each other. Without MALLOC_TRACE a call costs
+ * one test of traceState.
+ */
+#define TRACE_UNKNOWN 0		/* MALLOC_TRACE not yet read */
+#define TRACE_STARTING 1
+#define TRACE_ON 2
+#define TRACE_OFF 3
+
+static volatile int traceState = TRACE_UNKNOWN;
+static TraceHeader *traceHeader = NULL;
+static TraceRecord *traceRing = NULL;
+static struct timespec traceEpoch;		/* When the trace started */
+static unsigned traceThreads = 0;
+
+/* inTrace is volatile, or a compiler that takes the malloc() called
+ * inside malloc() for the builtin may drop the store before the call */
+#ifdef THREADS
+static __thread volatile int inTrace = 0;		/* In a logged call */
+static __thread unsigned traceThread = 0;
+#else
+static volatile int inTrace = 0;
+static unsigned traceThread = 0;
+#endif
+
+/* TRACING: Whether the call is to be logged */
+#define TRACING (traceState != TRACE_OFF && !inTrace && \
+		(traceState == TRACE_ON || traceStart()))
+
+/* traceStart: Map the file named by MALLOC_TRACE, if any, the first
+ * thread to get here does it. A %p in the name is replaced by the
+ * process id, so processes started by the traced one do not overwrite
+ * its trace. Returns whether calls are logged */
+static int traceStart(void)
+{
+	static char name[4096];
+	char *file = getenv("MALLOC_TRACE");
+	char *env = getenv("MALLOC_TRACE_RECORDS");
+	char *pid;
+	long capacity = (env != NULL) ? atol(env) : TRACE_RECORDS;
+	size_t length;
+	void *map = MAP_FAILED;
+	int fd;
+
+	if(!__sync_bool_compare_and_swap(&traceState, TRACE_UNKNOWN, TRACE_STARTING))
+	{
+		return traceState == TRACE_ON;		/* Not logged while starting */
+	}
+	if(file != NULL && (pid = strstr(file, "%p")) != NULL &&
+	   strlen(file) < sizeof(name) - 20)
+	{
+		memcpy(name, file, pid - file);
+		sprintf(name + (pid - file), "%d%s", (int) getpid(), pid + 2);
+		file = name;
+	}
+	if(file != NULL && capacity > 0 &&
+	   (fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644)) >= 0)
+	{
+		length = sizeof(TraceHeader) + capacity * sizeof(TraceRecord);
+		if(ftruncate(fd, length) == 0)
+		{
+			map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+	}
+	if(map == MAP_FAILED)
+	{
+		if(file != NULL)
+		{
+			perror("failed to start malloc trace");
+		}
+		traceState = TRACE_OFF;
+		return 0;
+	}
+
+	traceHeader = map;
+	traceRing = (TraceRecord *)(traceHeader + 1);
+	memcpy(traceHeader->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	traceHeader->capacity = capacity;
+	clock_gettime(CLOCK_MONOTONIC, &traceEpoch);
+	/* The ring must be seen before the state */
+	__sync_synchronize();
+	traceState = TRACE_ON;
+	return 1;
+}
+
+/* traceAdd: Log a call of operation op */
+static void traceAdd(unsigned op, size_t size, void * ptr, unsigned long old)
+{
+	struct timespec now;
+	TraceRecord *r;
+
+	if(traceThread == 0)
+	{
+		traceThread = __sync_add_and_fetch(&traceThreads, 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	r = &traceRing[__sync_fetch_and_add(&traceHeader->count, 1) % traceHeader->capacity];
+	r->time = (now.tv_sec - traceEpoch.tv_sec) * 1000000 +
+		(now.tv_nsec - traceEpoch.tv_nsec) / 1000;
+	r->size = size;
+	r->ptr = (unsigned long) ptr;
+	r->old = old;
+	r->info = op | (traceThread << TRACE_OPBITS);
+}
+
+void * malloc(size_t nbytes)
+{
+	Arena *a;
+	Header *p;
+	unsigned nunits;
+	void *ap;
+
+	if(TRACING)
+	{
+		inTrace = 1;
+		ap = malloc(nbytes);
+		inTrace = 0;
+		traceAdd(TRACE_MALLOC, nbytes, ap, 0);
+		return ap;
+	}
+
+	if(nbytes == 0) return NULL;
+
+	if(SAMPLING(nbytes) && (ap = profileAlloc(nbytes)) != NULL)
+	{
+		return ap;
+	}
+
+	if(nbytes <= SLAB_MAXSIZE)
+	{
+#ifdef THREADS
+		if((ap = tcacheGet(SLABCLASS(nbytes))) != NULL)
+		{
+			return ap;
+		}
+#endif
+		a = threadArena();
+		LOCK(&a->lock);
+		ap = slabAlloc(a, SLABCLASS(nbytes));
+		UNLOCK(&a->lock);
+		if(ap != NULL)
+		{
+			return ap;
+		}
+	}
+
+	if(nbytes >= MMAP_THRESHOLD)
+	{
+		p = bigAlloc(nbytes);
+		return (p == NULL) ? NULL : DATA(p);
+	}
+
+	/* Calculate the number of units in ( Headers ) required 
+	 * to store the given amount of nbytes data */
+	nunits = NUNITS(nbytes);
+
+	a = threadArena();
+	LOCK(&a->lock);
+	p = heapAlloc(a, nunits);
+	UNLOCK(&a->lock);
+
+	return (p == NULL) ? NULL : DATA(p);
+}
+
+/* free: Put block ap in the free list of its arena */
+void free(void * ap)
+{
+	Arena *a;
+	int slab;
+
+	if(ap == NULL) return;		/* Nothing to do */
+
+	if(TRACING)
 	{
-		newBlock = malloc(newSize);
-		
-		/* If malloc fails then we return a NULL ptr */
-		if(newBlock == NULL) return NULL;
-		
-		/* Get the old block header */
-		oldHeader = (Header *) oldBlock - 1;
-		oldSize = (oldHeader->s.size - 1) * sizeof(Header);
-		
-		/* Move the old data to the new area */
-		memmove(newBlock, oldBlock, min(newSize, oldSize));
-		
-		/* Clean up the old data */
-		free(oldBlock);
-		
+		traceAdd(TRACE_FREE, 0, ap, 0);
+	}
+
+	slab = ISSLAB(ap);
+	if(!slab && (BLOCKOF(ap)->s.flags & SAMPLED))
+	{
+		profileFree(ap);
+	}
+	if(!slab && (BLOCKOF(ap)->s.flags & MAPPED))
+	{
+		bigFree(BLOCKOF(ap));
+		return;
+	}
+	a = slab ? &arenas[SLABOF(ap)->arena] : ARENAOF(BLOCKOF(ap));
+#ifdef THREADS
+	if(a != threadArena())
+	{
+		remotePush(a, ap);
+		return;
+	}
+	if(slab && tcachePut(ap))
+	{
+		return;
+	}
+#endif
+	LOCK(&a->lock);
+	if(slab)
+	{
+		slabFree(a, ap);
+	}
+	else
+	{
+		a->untrimmed += BLOCKOF(ap)->s.size * sizeof(Header);
+		a->heap.frees++;
+		a->heap.inUse -= BLOCKOF(ap)->s.size * sizeof(Header);
+		heapFree(a, BLOCKOF(ap));
+		if(a->untrimmed >= TRIM_THRESHOLD)
+		{
+			a->untrimmed = 0;
+			trimTop(a, TRIM_PAD);
+		}
+	}
+	UNLOCK(&a->lock);
+}
+
+/* malloc_trim: Give free memory back to the system, keeping pad bytes at
+ * the end of each arena. Returns 1 if any memory was released */
+int malloc_trim(size_t pad)
+{
+	Arena *a;
+	int released;
+
+	threadArena();		/* Arenas are set up */
+	released = slabTrim();
+	for(a = arenas; a < arenas + narenas; a++)
+	{
+		LOCK(&a->lock);
+		released |= arenaTrim(a, pad);
+		UNLOCK(&a->lock);
+	}
+	return released;
+}
+
+/* Free blocks of an arena, see freeInfo() */
+typedef struct
+{
+	size_t blocks;
+	size_t bytes;
+	size_t largest;
+} FreeInfo;
+
+/* freeAdd: Count free block p */
+static void freeAdd(FreeInfo * fi, Header * p)
+{
+	size_t bytes = (size_t) p->s.size * sizeof(Header);
+
+	fi->blocks++;
+	fi->bytes += bytes;
+	if(bytes > fi->largest)
+	{
+		fi->largest = bytes;
+	}
+}
+
+/* treeInfo: Count the free blocks of the tree at p */
+static void treeInfo(FreeInfo * fi, Header * p)
+{
+	for( ; p != NULL; p = RIGHT(p))
+	{
+		treeInfo(fi, LEFT(p));
+		freeAdd(fi, p);
+	}
+}
+
+/* freeInfo: Count the free blocks of arena a, which must be locked */
+static void freeInfo(Arena * a, FreeInfo * fi)
+{
+	Header *p;
+	unsigned c;
+
+	fi->blocks = fi->bytes = fi->largest = 0;
+	if(a->freep == NULL) return;		/* Never used */
+
+	if(!sizeClasses)
+	{
+		for(p = a->base->s.ptr; p != a->base; p = p->s.ptr)
+		{
+			freeAdd(fi, p);
+		}
+		return;
+	}
+	for(c = 0; c < NCLASSES; c++)
+	{
+		if(sizeTrees && c >= NEXACT)
+		{
+			treeInfo(fi, a->classList[c]);
+			continue;
+		}
+		for(p = a->classList[c]; p != NULL; p = p->s.ptr)
+		{
+			freeAdd(fi, p);
+		}
+	}
+}
+
+/* slabInfo: Number of slabs of class c with free slots in arena a, and
+ * the free slots in them */
+static size_t slabInfo(Arena * a, unsigned c, size_t * nfree)
+{
+	Slab *sp;
+	size_t nslabs = 0;
+
+	*nfree = 0;
+	for(sp = a->partial[c]; sp != NULL; sp = sp->next)
+	{
+		nslabs++;
+		*nfree += sp->nfree;
+	}
+	return nslabs;
+}
+
+/* mallinfo2: Totals over all arenas, laid out like the one of glibc */
+struct mallinfo2 mallinfo2(void)
+{
+	struct mallinfo2 mi;
+	FreeInfo fi;
+	Arena *a;
+	unsigned c;
+	size_t nfree;
+
+	memset(&mi, 0, sizeof(mi));
+	threadArena();		/* Arenas are set up */
+	for(a = arenas; a < arenas + narenas; a++)
+	{
+		LOCK(&a->lock);
+		freeInfo(a, &fi);
+		mi.arena += a->heapBytes;
+		mi.ordblks += fi.blocks;
+		mi.fordblks += fi.bytes;
+		mi.uordblks += a->heap.inUse;
+		if(a->fence != NULL && (a->fence->s.flags & PREVFREE))
+		{
+			mi.keepcost += (size_t) PREVBLOCK(a->fence)->s.size * sizeof(Header);
+		}
+		for(c = 0; c < SLAB_CLASSES; c++)
+		{
+			mi.uordblks += a->slab[c].inUse;
+			slabInfo(a, c, &nfree);
+			mi.smblks += nfree;
+			mi.fsmblks += nfree * (c + 1) * SLAB_QUANTUM;
+		}
+		UNLOCK(&a->lock);
+	}
+	LOCK(&growLock);
+	mi.arena += slabTop - slabRegion;
+	UNLOCK(&growLock);
+	mi.hblks = mappedBlocks;
+	mi.hblkhd = mappedBytes;
+	return mi;
+}
+
+/* fragmentation: Share of the free bytes outside the largest free block */
+static double fragmentation(FreeInfo * fi)
+{
+	return (fi->bytes == 0) ? 0.0 : 1.0 - (double) fi->largest / fi->bytes;
+}
+
+/* Statistics of one arena, taken under its lock and written out after */
+typedef struct
+{
+	size_t heapBytes;
+	Counts heap;
+	FreeInfo fi;
+	Counts slab[SLAB_CLASSES];
+	size_t nslabs[SLAB_CLASSES];		/* With free slots */
+	size_t nfree[SLAB_CLASSES];
+} ArenaStats;
+
+/* arenaStats: Fill st with the statistics of arena a */
+static void arenaStats(Arena * a, ArenaStats * st)
+{
+	unsigned c;
+
+	LOCK(&a->lock);
+	st->heapBytes = a->heapBytes;
+	st->heap = a->heap;
+	freeInfo(a, &st->fi);
+	for(c = 0; c < SLAB_CLASSES; c++)
+	{
+		st->slab[c] = a->slab[c];
+		st->nslabs[c] = slabInfo(a, c, &st->nfree[c]);
+	}
+	UNLOCK(&a->lock);
+}
+
+/* statsWrite: Write the statistics of every arena to f, as text or JSON.
+ * stdio may allocate, so no lock is held while writing */
+static void statsWrite(FILE * f, int json)
+{
+	ArenaStats st;
+	Arena *a;
+	unsigned c;
+
+	if(json)
+	{
+		fprintf(f, "{\"strategy\": %d, \"mappedBlocks\": %lu, \"mappedBytes\": %lu, \"arenas\": [",
+			strategy, (unsigned long) mappedBlocks, (unsigned long) mappedBytes);
+	}
+	else
+	{
+		fprintf(f, "Strategy %d, %lu mapped blocks of %lu bytes\n",
+			strategy, (unsigned long) mappedBlocks, (unsigned long) mappedBytes);
+	}
+	for(a = arenas; a < arenas + narenas; a++)
+	{
+		arenaStats(a, &st);
+		if(json)
+		{
+			fprintf(f, "%s\n {\"heapBytes\": %lu, \"allocs\": %lu, \"frees\": %lu, \"inUse\": %lu, "
+				"\"freeBlocks\": %lu, \"freeBytes\": %lu, \"largestFree\": %lu, "
+				"\"fragmentation\": %.3f, \"slabClasses\": [",
+				(a == arenas) ? "" : ",", (unsigned long) st.heapBytes,
+				(unsigned long) st.heap.allocs, (unsigned long) st.heap.frees,
+				(unsigned long) st.heap.inUse, (unsigned long) st.fi.blocks,
+				(unsigned long) st.fi.bytes, (unsigned long) st.fi.largest, fragmentation(&st.fi));
+		}
+		else
+		{
+			fprintf(f, "Arena %lu: %lu bytes of heap, %lu allocs, %lu frees, %lu bytes in use\n"
+				"  %lu free blocks of %lu bytes, largest %lu, fragmentation %.3f\n"
+				"  slab size    allocs     frees    in use  slabs  free slots\n",
+				(unsigned long)(a - arenas), (unsigned long) st.heapBytes,
+				(unsigned long) st.heap.allocs, (unsigned long) st.heap.frees,
+				(unsigned long) st.heap.inUse, (unsigned long) st.fi.blocks,
+				(unsigned long) st.fi.bytes, (unsigned long) st.fi.largest, fragmentation(&st.fi));
+		}
+		for(c = 0; c < SLAB_CLASSES; c++)
+		{
+			if(json)
+			{
+				fprintf(f, "%s\n  {\"size\": %u, \"allocs\": %lu, \"frees\": %lu, \"inUse\": %lu, "
+					"\"partialSlabs\": %lu, \"freeSlots\": %lu}",
+					(c == 0) ? "" : ",", (c + 1) * SLAB_QUANTUM,
+					(unsigned long) st.slab[c].allocs, (unsigned long) st.slab[c].frees,
+					(unsigned long) st.slab[c].inUse, (unsigned long) st.nslabs[c],
+					(unsigned long) st.nfree[c]);
+			}
+			else if(st.slab[c].allocs != 0)
+			{
+				fprintf(f, "  %9u %9lu %9lu %9lu %6lu %11lu\n", (c + 1) * SLAB_QUANTUM,
+					(unsigned long) st.slab[c].allocs, (unsigned long) st.slab[c].frees,
+					(unsigned long) st.slab[c].inUse, (unsigned long) st.nslabs[c],
+					(unsigned long) st.nfree[c]);
+			}
+		}
+		if(json)
+		{
+			fprintf(f, "]}");
+		}
+	}
+	if(json)
+	{
+		fprintf(f, "\n]}\n");
+	}
+}
+
+/* malloc_stats: Print the statistics of every arena to stderr */
+void malloc_stats(void)
+{
+	threadArena();		/* Arenas are set up */
+	statsWrite(stderr, 0);
+}
+
+/* statsExit: Write the statistics as JSON to the file named by
+ * MALLOC_STATS_JSON */
+static void statsExit(void)
+{
+	FILE *f = fopen(getenv("MALLOC_STATS_JSON"), "w");
+
+	if(f == NULL)
+	{
+		perror("failed to write malloc statistics");
+		return;
+	}
+	statsWrite(f, 1);
+	fclose(f);
+}
+
+/* shrinkBlock: Cut allocated block bp of arena a down to nunits units,
+ * freeing the tail if it is large enough to be listed */
+static void shrinkBlock(Arena * a, Header * bp, unsigned nunits)
+{
+	Header *tail;
+
+	if(bp->s.size - nunits < MINUNITS) return;
+
+	tail = bp + nunits;
+	tail->s.size = bp->s.size - nunits;
+	tail->s.flags = INUSE | (bp->s.flags & ~(INUSE | PREVFREE | SAMPLED));
+	bp->s.size = nunits;
+	heapFree(a, tail);
+}
+
+/* growBlock: Grow allocated block bp of arena a to nunits units by taking
+ * in the free block after it, extending the heap first when bp is the
+ * last block. Returns 0 if the block can not grow where it is */
+static int growBlock(Arena * a, Header * bp, unsigned nunits)
+{
+	Header *next = NEXTBLOCK(bp);
+
+	if(next == a->fence ||
+	   (!(next->s.flags & INUSE) && NEXTBLOCK(next) == a->fence &&
+	    bp->s.size + next->s.size < nunits))
+	{
+		/* Only helps if the new chunk lands right after this one */
+		if(morecore(a, nunits - bp->s.size) == NULL) return 0;
+		next = NEXTBLOCK(bp);
+	}
+	if((next->s.flags & INUSE) || bp->s.size + next->s.size < nunits) return 0;
+
+	listRemove(a, next);
+	bp->s.size += next->s.size;
+	NEXTBLOCK(bp)->s.flags &= ~PREVFREE;
+	shrinkBlock(a, bp, nunits);
+	cleanUse(a, bp);
+	return 1;
+}
+
+/* calloc: Allocate a zeroed array. Also keeps libc (e.g. the -pg
+ * profiling support) from handing free() blocks that are not ours.
+ * Memory fresh from the system is zero already: a block of its own
+ * mapping is never cleared, and a heap block from the clean range of
+ * its arena only needs its first two and last unit cleared */
+void * calloc(size_t count, size_t size)
+{
+	Arena *a;
+	Header *p;
+	size_t nbytes;
+	void * block;
+	int fresh;
+
+	if(TRACING)
+	{
+		inTrace = 1;
+		block = calloc(count, size);
+		inTrace = 0;
+		traceAdd(TRACE_CALLOC, count * size, block, 0);
+		return block;
+	}
+
+	if(size != 0 && count > (size_t) -1 / size)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	nbytes = count * size;
+
+	if(nbytes >= MMAP_THRESHOLD)
+	{
+		return malloc(nbytes);
+	}
+	if(nbytes <= SLAB_MAXSIZE)
+	{
+		block = malloc(nbytes);
+		if(block != NULL)
+		{
+			memset(block, 0, nbytes);
+		}
+		return block;
+	}
+
+	if(SAMPLING(nbytes) && (block = profileAlloc(nbytes)) != NULL)
+	{
+		memset(block, 0, nbytes);
+		return block;
+	}
+
+	a = threadArena();
+	LOCK(&a->lock);
+	p = heapAlloc(a, NUNITS(nbytes));
+	fresh = (p != NULL && a->fresh);
+	UNLOCK(&a->lock);
+	if(p == NULL) return NULL;
+
+	if(fresh)
+	{
+		memset(DATA(p), 0, MINUNITS * sizeof(Header) - HEADERSIZE);
+		memset(NEXTBLOCK(p) - 1, 0, sizeof(Header));
+	}
+	else
+	{
+		memset(DATA(p), 0, nbytes);
+	}
+	return DATA(p);
+}
+
+void * realloc(void * oldBlock, size_t newSize)
+{
+	void * newBlock = NULL;
+	size_t oldSize = 0;
+
+	if(TRACING)
+	{
+		unsigned long old = (unsigned long) oldBlock;
+
+		inTrace = 1;
+		newBlock = realloc(oldBlock, newSize);
+		inTrace = 0;
+		traceAdd(TRACE_REALLOC, newSize, newBlock, old);
 		return newBlock;
 	}
+
+	if(oldBlock == NULL)
+	{
+		/* if oldBlock is NULL then we just allocate as normal */
+		return malloc(newSize);
+	}
+	else if(newSize == 0)
+	{
+		/* newSize is zero which means that no data will be moved to 
+		 * the new block (free the old block) */
+		free(oldBlock);
+		return NULL;
+	}
+	else if(ISSLAB(oldBlock))
+	{
+		/* Still the same slab class, nothing to do */
+		if(newSize <= SLAB_MAXSIZE &&
+		   SLABCLASS(newSize) == SLABOF(oldBlock)->size / SLAB_QUANTUM - 1)
+		{
+			return oldBlock;
+		}
+	}
+	else if(BLOCKOF(oldBlock)->s.flags & MAPPED)
+	{
+		/* Stays large, let the kernel move the pages */
+		Header * newHeader;
+
+		if(newSize >= MMAP_THRESHOLD &&
+		   (newHeader = bigRealloc(BLOCKOF(oldBlock), newSize)) != NULL)
+		{
+			if(newHeader->s.flags & SAMPLED)
+			{
+				profileMove(oldBlock, DATA(newHeader), newSize);
+			}
+			return DATA(newHeader);
+		}
+	}
+	else
+	{
+		/* Shrink or grow the block where it is if possible */
+		Header * oldHeader = BLOCKOF(oldBlock);
+		Arena * a = ARENAOF(oldHeader);
+		unsigned nunits = NUNITS(newSize);
+		int inPlace = 1;
+
+		if(newSize > (size_t)((unsigned) -1 - 1) * sizeof(Header)) return NULL;
+
+		LOCK(&a->lock);
+		a->heap.inUse -= oldHeader->s.size * sizeof(Header);
+		if(nunits <= oldHeader->s.size)
+		{
+			shrinkBlock(a, oldHeader, nunits);
+		}
+		else
+		{
+			inPlace = growBlock(a, oldHeader, nunits);
+		}
+		a->heap.inUse += oldHeader->s.size * sizeof(Header);
+		UNLOCK(&a->lock);
+
+		if(inPlace && (oldHeader->s.flags & SAMPLED))
+		{
+			profileMove(oldBlock, oldBlock, newSize);
+		}
+		if(inPlace) return oldBlock;
+	}
+
+	/* Move the block */
+	newBlock = malloc(newSize);
+
+	/* If malloc fails then we return a NULL ptr */
+	if(newBlock == NULL) return NULL;
+
+	oldSize = blockSize(oldBlock);
+
+	/* Move the old data to the new area */
+	memmove(newBlock, oldBlock, (newSize < oldSize) ? newSize : oldSize);
+
+	/* Clean up the old data */
+	free(oldBlock);
+
+	return newBlock;
+}
+
+/* alignedAlloc: Allocate nbytes bytes at a multiple of align, a power of
+ * two. Slab slots are aligned to their size up to the alignment of the
+ * first slot, larger alignments are carved out of the heap */
+static void * alignedAlloc(size_t align, size_t nbytes)
+{
+	Arena *a;
+	Header *p;
+	unsigned nunits;
+	void *ap;
+
+	if(TRACING)
+	{
+		inTrace = 1;
+		ap = alignedAlloc(align, nbytes);
+		inTrace = 0;
+		traceAdd(TRACE_MEMALIGN, nbytes, ap, align);
+		return ap;
+	}
+
+	if(align <= sizeof(Header)) return malloc(nbytes);
+	if(nbytes == 0) return NULL;
+
+	if(SLAB_FIRST % align == 0 && ALIGNUP(nbytes, align) <= SLAB_MAXSIZE)
+	{
+		ap = malloc(ALIGNUP(nbytes, align));
+		if(((unsigned long) ap & (align - 1)) == 0) return ap;
+		free(ap);		/* From the heap after all */
+	}
+
+	if(nbytes / sizeof(Header) + align / sizeof(Header) + MINUNITS + 2 >= (unsigned) -1)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	nunits = NUNITS(nbytes);
+
+	if(fit == chooseFit)
+	{
+		strategyInit();
+	}
+	a = threadArena();
+	LOCK(&a->lock);
+	p = heapAligned(a, nunits, align);
+	UNLOCK(&a->lock);
+
+	return (p == NULL) ? NULL : DATA(p);
+}
+
+/* ALIGNOK: align is a power of two */
+#define ALIGNOK(align) ((align) != 0 && ((align) & ((align) - 1)) == 0)
+
+void * memalign(size_t align, size_t nbytes)
+{
+	if(!ALIGNOK(align))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	return alignedAlloc(align, nbytes);
+}
+
+void * aligned_alloc(size_t align, size_t nbytes)
+{
+	return memalign(align, nbytes);
+}
+
+int posix_memalign(void ** memptr, size_t align, size_t nbytes)
+{
+	void *ap;
+
+	if(!ALIGNOK(align) || align % sizeof(void *) != 0) return EINVAL;
+
+	ap = alignedAlloc(align, nbytes);
+	if(ap == NULL && nbytes != 0) return ENOMEM;
+	*memptr = ap;
+	return 0;
+}
+
+void * valloc(size_t nbytes)
+{
+	return alignedAlloc(getpagesize(), nbytes);
+}
+
+/* pvalloc: Like valloc() with the size rounded up to whole pages */
+void * pvalloc(size_t nbytes)
+{
+	size_t page = getpagesize();
+
+	if(nbytes > (size_t) -1 - page) return NULL;
+	return alignedAlloc(page, (nbytes + page - 1) & ~(page - 1));
+}
+
+/* reallocarray: realloc() of an array, failing if the size overflows */
+void * reallocarray(void * oldBlock, size_t count, size_t size)
+{
+	if(size != 0 && count > (size_t) -1 / size)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	return realloc(oldBlock, count * size);
+}
+
+/* malloc_usable_size: Number of bytes that fit in block ap */
+size_t malloc_usable_size(void * ap)
+{
+	return (ap == NULL) ? 0 : blockSize(ap);
 }
@@ -1,7 +1,34 @@
 #ifndef __MALLOC_H__
 #define __MALLOC_H__
 
+/* Laid out like the one of glibc, see mallinfo2() */
+struct mallinfo2
+{
+  size_t arena;		/* Bytes of heap and slabs from the system */
+  size_t ordblks;	/* Free heap blocks */
+  size_t smblks;	/* Free slab slots */
+  size_t hblks;		/* Blocks with a mapping of their own */
+  size_t hblkhd;	/* Bytes in those mappings */
+  size_t usmblks;	/* Always 0 */
+  size_t fsmblks;	/* Bytes in free slab slots */
+  size_t uordblks;	/* Bytes in use in the heap and slabs */
+  size_t fordblks;	/* Bytes in free heap blocks */
+  size_t keepcost;	/* Bytes malloc_trim() could give back at the top */
+};
+
 extern void *malloc(size_t);
 extern void free(void *);
 extern void *realloc(void *, size_t);
+extern void *calloc(size_t, size_t);
+extern int malloc_trim(size_t);
+extern void *memalign(size_t, size_t);
+extern void *aligned_alloc(size_t, size_t);
+extern int posix_memalign(void **, size_t, size_t);
+extern void *valloc(size_t);
+extern void *pvalloc(size_t);
+extern void *reallocarray(void *, size_t, size_t);
+extern size_t malloc_usable_size(void *);
+extern struct mallinfo2 mallinfo2(void);
+extern void malloc_stats(void);
+extern int malloc_profile_dump(const char *);
 #endif
@@ -0,0 +1,315 @@
+/*gcc -O2 -fno-builtin -DSTRATEGY=2 replay.c -o ReplayCust && gcc -O2 -fno-builtin replay.c -o ReplayStd
+  Usage: ReplayCust [-q] TRACE, TRACE recorded with MALLOC_TRACE=TRACE */
+
+/*
+ * DESCRIPTION:
+ *  Replays an allocation trace recorded with MALLOC_TRACE (see trace.h)
+ *  against the malloc the program is built with, or the one given with
+ *  LD_PRELOAD to ReplayStd, and reports the throughput, the latency
+ *  percentiles of every kind of call and the peak footprint.
+ *
+ *  The calls of all threads are replayed in the order they returned, from
+ *  one thread. A block is known by the address it had when recorded, and
+ *  is touched once per page so it takes up memory like it did then. Frees
+ *  of blocks allocated before the ring of the trace starts are skipped.
+ *  The replay keeps its own tables and buffers outside malloc(), so only
+ *  the blocks of the trace count in the footprint.
+ */
+
+#ifdef STRATEGY
+#include "malloc.c"
+#else
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "trace.h"
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include "latency.h"
+
+#define CHUNK 4096        /* Records read at once */
+#define PAGE 4096         /* Blocks are touched once per page */
+
+enum { ALLOC, REALLOC, FREE, ALL, KINDS };
+const char *kindNames[KINDS] = {"alloc", "realloc", "free", "all"};
+
+/* Live blocks by their recorded address, open addressing */
+typedef struct {
+  unsigned long key;      /* 0 if unused */
+  void *block;
+  size_t size;
+} Entry;
+
+char *progname;
+bool quiet = false;
+Histogram hist[KINDS];
+Entry *table = NULL;
+unsigned long tableSize = 0, tableUsed = 0;
+size_t liveSize = 0, peakSize = 0;
+unsigned long skipped = 0;
+
+/* Memory for the replay itself, kept out of the malloc being measured */
+void * mapMemory(size_t length){
+  void *p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED){
+    perror(progname);
+    exit(1);
+  }
+  return p;
+}
+
+void addLatency(int kind, unsigned long ns){
+  histAdd(&hist[kind], ns);
+  histAdd(&hist[ALL], ns);
+}
+
+/**
+ * Table of live blocks
+ */
+unsigned long hashOf(unsigned long key){
+  return (key >> 4) * 0x9E3779B97F4A7C15UL;
+}
+
+Entry * lookup(unsigned long key){
+  unsigned long i = hashOf(key) & (tableSize - 1);
+
+  while(table[i].key != 0 && table[i].key != key){
+    i = (i + 1) & (tableSize - 1);
+  }
+  return &table[i];
+}
+
+void insert(unsigned long key, void *block, size_t size);
+
+void growTable(void){
+  Entry *old = table;
+  unsigned long i, oldSize = tableSize;
+
+  tableSize = oldSize ? 2 * oldSize : 1024;
+  table = mapMemory(tableSize * sizeof(Entry));
+  tableUsed = 0;
+  for(i = 0; i < oldSize; i++){
+    if(old[i].key != 0){
+      insert(old[i].key, old[i].block, old[i].size);
+    }
+  }
+  if(old != NULL) munmap(old, oldSize * sizeof(Entry));
+}
+
+void insert(unsigned long key, void *block, size_t size){
+  Entry *e;
+
+  if(2 * (tableUsed + 1) > tableSize) growTable();
+  e = lookup(key);
+  e->key = key;
+  e->block = block;
+  e->size = size;
+  tableUsed++;
+}
+
+/* Take entry e out, moving later entries of its run back into the gap */
+void removeEntry(Entry *e){
+  unsigned long gap = e - table, i = gap, home;
+
+  for(;;){
+    i = (i + 1) & (tableSize - 1);
+    if(table[i].key == 0) break;
+    home = hashOf(table[i].key) & (tableSize - 1);
+    /* Can table[i] move to the gap without leaving its run? */
+    if(((i - home) & (tableSize - 1)) >= ((i - gap) & (tableSize - 1))){
+      table[gap] = table[i];
+      gap = i;
+    }
+  }
+  table[gap].key = 0;
+  tableUsed--;
+}
+
+/**
+ * Replay
+ */
+void touch(char *block, size_t size){
+  size_t i;
+
+  for(i = 0; i < size; i += PAGE){
+    block[i] = 1;
+  }
+  if(size > 0) block[size - 1] = 1;
+}
+
+void addBlock(unsigned long key, void *block, size_t size){
+  Entry *e;
+
+  if(key == 0 || block == NULL){
+    free(block);          /* Failed when recorded */
+    return;
+  }
+  e = lookup(key);
+  if(e->key == key){
+    /* Its free was logged after the address was handed out again */
+    liveSize -= e->size;
+    free(e->block);
+    removeEntry(e);
+  }
+  touch(block, size);
+  insert(key, block, size);
+  liveSize += size;
+  if(liveSize > peakSize) peakSize = liveSize;
+}
+
+void replay(TraceRecord *r){
+  Entry *e;
+  void *block = NULL;
+  unsigned long start;
+
+  switch(r->info & ((1 << TRACE_OPBITS) - 1)){
+  case TRACE_MALLOC:
+    start = nowNanos();
+    block = malloc(r->size);
+    addLatency(ALLOC, nowNanos() - start);
+    addBlock(r->ptr, block, r->size);
+    break;
+  case TRACE_CALLOC:
+    start = nowNanos();
+    block = calloc(1, r->size);
+    addLatency(ALLOC, nowNanos() - start);
+    addBlock(r->ptr, block, r->size);
+    break;
+  case TRACE_MEMALIGN:
+    start = nowNanos();
+    if(posix_memalign(&block, r->old, r->size) != 0) block = NULL;
+    addLatency(ALLOC, nowNanos() - start);
+    addBlock(r->ptr, block, r->size);
+    break;
+  case TRACE_REALLOC:
+    if(r->old != 0){
+      e = lookup(r->old);
+      if(e->key == r->old){
+        block = e->block;
+        liveSize -= e->size;
+        removeEntry(e);
+      }else{
+        skipped++;        /* From before the trace, realloc() as malloc() */
+      }
+    }
+    start = nowNanos();
+    block = realloc(block, r->size);
+    addLatency(REALLOC, nowNanos() - start);
+    addBlock(r->ptr, block, r->size);
+    break;
+  case TRACE_FREE:
+    e = lookup(r->ptr);
+    if(e->key != r->ptr){
+      skipped++;
+      break;
+    }
+    block = e->block;
+    liveSize -= e->size;
+    removeEntry(e);
+    start = nowNanos();
+    free(block);
+    addLatency(FREE, nowNanos() - start);
+    break;
+  default:
+    skipped++;            /* Never written, or written by a crashed writer */
+  }
+}
+
+/* Replay records first to first + n - 1 of the ring in fd */
+void replayRange(int fd, TraceRecord *buf, unsigned long first, unsigned long n){
+  unsigned long i;
+  ssize_t got;
+
+  while(n > 0){
+    got = pread(fd, buf, (n < CHUNK ? n : CHUNK) * sizeof(TraceRecord),
+                sizeof(TraceHeader) + first * sizeof(TraceRecord));
+    if(got < (ssize_t) sizeof(TraceRecord)){
+      fprintf(stderr, "%s: trace ends early\n", progname);
+      return;
+    }
+    got /= sizeof(TraceRecord);
+    for(i = 0; i < (unsigned long) got; i++){
+      replay(&buf[i]);
+    }
+    first += got;
+    n -= got;
+  }
+}
+
+/* Peak resident set of the process in kB */
+long peakRss(void){
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+int main(int argc, char *argv[]){
+  TraceHeader th;
+  TraceRecord *buf;
+  unsigned long n, first, start, elapsed;
+  long rssBefore;
+  char *file = NULL;
+  int fd, i;
+
+  progname = (argc > 0) ? argv[0] : "";
+  for(i = 1; i < argc; i++){
+    if(!strcmp(argv[i], "-q")) quiet = true;
+    else file = argv[i];
+  }
+  if(file == NULL){
+    fprintf(stderr, "usage: %s [-q] TRACE\n", progname);
+    return 2;
+  }
+  if((fd = open(file, O_RDONLY)) < 0 ||
+     read(fd, &th, sizeof(th)) != sizeof(th) ||
+     memcmp(th.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+     th.capacity == 0){
+    fprintf(stderr, "%s: %s is not a malloc trace\n", progname, file);
+    return 1;
+  }
+
+  /* The oldest record follows the newest once the ring has wrapped */
+  n = (th.count < th.capacity) ? th.count : th.capacity;
+  first = (th.count < th.capacity) ? 0 : th.count % th.capacity;
+  buf = mapMemory(CHUNK * sizeof(TraceRecord));
+  growTable();
+
+  rssBefore = peakRss();
+  start = nowNanos();
+  replayRange(fd, buf, first, n - first);
+  replayRange(fd, buf, 0, first);
+  elapsed = nowNanos() - start;
+  close(fd);
+
+  if(!quiet){
+    #ifdef STRATEGY
+    printf("Replaying %s with custom malloc, strategy %s\n", file,
+           getenv("MALLOC_STRATEGY") ? getenv("MALLOC_STRATEGY") : "default");
+    #else
+    printf("Replaying %s with system malloc\n", file);
+    #endif
+    printf("%lu calls (%lu skipped), %lu dropped from the ring\n",
+           n, skipped, th.count - n);
+  }
+  printf("time %lu ms, %.0f calls/s\n", elapsed / 1000000,
+         hist[ALL].count / (elapsed / 1e9));
+  printf("%-8s %10s %8s %8s %8s %8s %10s (ns)\n",
+         "call", "count", "mean", "p50", "p99", "p99.9", "max");
+  for(i = 0; i < KINDS; i++){
+    if(hist[i].count == 0) continue;
+    printf("%-8s %10lu %8lu %8lu %8lu %8lu %10lu\n", kindNames[i],
+           hist[i].count, hist[i].total / hist[i].count,
+           percentile(&hist[i], 0.50), percentile(&hist[i], 0.99),
+           percentile(&hist[i], 0.999), hist[i].max);
+  }
+  printf("peak live %lu kB, peak RSS %ld kB (%ld kB before replay)\n",
+         (unsigned long)(peakSize / 1024), peakRss(), rssBefore);
+  return 0;
+}
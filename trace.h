@@ -0,0 +1,44 @@
+#ifndef _trace_h_
+#define _trace_h_
+
+/* Allocation trace
+ *
+ * With MALLOC_TRACE=<file> in the environment malloc.c logs every call
+ * of malloc(), calloc(), realloc(), free() and memalign() and friends to
+ * file, read back by replay.c. The file is a TraceHeader followed by a
+ * ring of fixed size records, mapped shared so records reach the file
+ * without a write() and survive a crash. Once the ring is full the
+ * oldest records are overwritten, count tells where the ring starts.
+ * Blocks are known by their address, records are in the order their
+ * calls returned (a free() is logged before the block is released). A
+ * %p in the file name is replaced by the process id.
+ */
+#define TRACE_MAGIC "MTRACE2"
+#define TRACE_RECORDS (1024 * 1024)	/* Default ring size, MALLOC_TRACE_RECORDS */
+
+#define TRACE_MALLOC 1
+#define TRACE_CALLOC 2
+#define TRACE_REALLOC 3
+#define TRACE_FREE 4
+#define TRACE_MEMALIGN 5
+#define TRACE_OPBITS 4		/* Thread number above the operation in info */
+
+typedef struct
+{
+	char magic[8];				/* TRACE_MAGIC */
+	unsigned long capacity;		/* Records in the ring */
+	unsigned long count;		/* Records ever written */
+	unsigned long pad;
+} TraceHeader;
+
+typedef struct
+{
+	unsigned int info;			/* Operation, and the thread above TRACE_OPBITS */
+	unsigned int pad;
+	unsigned long time;			/* Microseconds since the trace started */
+	unsigned long size;			/* Bytes asked for */
+	unsigned long ptr;			/* Block returned or freed */
+	unsigned long old;			/* realloc(): old block, memalign(): alignment */
+} TraceRecord;
+
+#endif /*_trace_h_ */
@@ -0,0 +1,151 @@
+/*
+ * Tests posix_memalign(), aligned_alloc() and memalign() for alignments
+ * from 16 bytes to 2 MB. Every block is checked for its alignment and
+ * filled with a pattern that is checked again before it is freed, and
+ * aligned blocks must not take up as much as their size plus alignment.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "malloc.h"
+#include "tst.h"
+
+#define MINALIGN 16
+#define MAXALIGN (2 * 1024 * 1024)
+#define NSIZES 6
+#define BLOCKS 256
+
+#define MAX(a,b) ((a > b) ? (a) : (b))
+
+char *progname;
+static int errors = 0;
+static size_t sizes[NSIZES] = {1, 63, 64, 1000, 4096, 100000};
+
+static void fill(char *p, size_t size, int seed)
+{
+  size_t i;
+  for(i = 0; i < size; i++)
+    p[i] = (seed + i) & 0xff;
+}
+
+static int check(char *p, size_t size, int seed)
+{
+  size_t i;
+  for(i = 0; i < size; i++)
+    if((p[i] & 0xff) != ((seed + i) & 0xff))
+      return 0;
+  return 1;
+}
+
+static int aligned(void *p, size_t align)
+{
+  return ((unsigned long) p & (align - 1)) == 0;
+}
+
+/* Many blocks of one size and alignment must lie closer together than
+   size + align bytes apart, which is what padding every request by its
+   alignment would take */
+static void usage(size_t align, size_t size)
+{
+  char *block[BLOCKS], *low, *high;
+  float each;
+  int i;
+
+  low = high = NULL;
+  for(i = 0; i < BLOCKS; i++){
+    block[i] = aligned_alloc(align, size);
+    if(block[i] == NULL || !aligned(block[i], align)){
+      MESSAGE("* ERROR: aligned_alloc failed\n");
+      errors++;
+      return;
+    }
+    if(low == NULL || block[i] < low)
+      low = block[i];
+    if(high == NULL || block[i] + size > high)
+      high = block[i] + size;
+  }
+  for(i = 0; i < BLOCKS; i++)
+    free(block[i]);
+
+  each = (high - low) / (float) BLOCKS;
+  fprintf(stderr, "%s: %lu byte blocks aligned to %lu take %.0f bytes each\n",
+          progname, (unsigned long) size, (unsigned long) align, each);
+  if(each >= size + align){
+    MESSAGE("* ERROR: Test indicates excessive memory usage\n");
+    errors++;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  void *block[NSIZES * 32];
+  size_t align, size[NSIZES * 32];
+  int i, n = 0;
+  char *p, *ballast;
+
+  if (argc > 0)
+    progname = argv[0];
+  else
+    progname = "";
+
+  MESSAGE("-- Test aligned allocation\n");
+
+  /* On a heap that is in use, the second time where the first left
+     free blocks */
+  ballast = malloc(10000);
+  usage(4096, 3000);
+  usage(64, 1000);
+
+  for(align = MINALIGN; align <= MAXALIGN; align <<= 1){
+    for(i = 0; i < NSIZES; i++){
+      if(posix_memalign(&block[n], align, sizes[i]) != 0 || block[n] == NULL){
+        MESSAGE("* ERROR: posix_memalign failed\n");
+        errors++;
+        continue;
+      }
+      if(!aligned(block[n], align)){
+        fprintf(stderr, "%s: block of %lu bytes not aligned to %lu\n",
+                progname, (unsigned long) sizes[i], (unsigned long) align);
+        MESSAGE("* ERROR: Wrong alignment\n");
+        errors++;
+      }
+      size[n] = sizes[i];
+      fill(block[n], size[n], n);
+      n++;
+    }
+  }
+  for(i = 0; i < n; i++){
+    if(!check(block[i], size[i], i)){
+      MESSAGE("* ERROR: Corrupt memory handling\n");
+      errors++;
+    }
+    /* Every other block is moved by realloc() first */
+    if(i % 2){
+      block[i] = realloc(block[i], size[i] * 3);
+      if(block[i] == NULL || !check(block[i], size[i], i)){
+        MESSAGE("* ERROR: realloc of aligned block failed\n");
+        errors++;
+      }
+    }
+    free(block[i]);
+  }
+
+  p = memalign(4096, 100);
+  if(p == NULL || !aligned(p, 4096)){
+    MESSAGE("* ERROR: memalign failed\n");
+    errors++;
+  }
+  free(p);
+
+  if(posix_memalign(&block[0], 24, 100) != EINVAL ||
+     aligned_alloc(3, 100) != NULL){
+    MESSAGE("* ERROR: Bad alignment accepted\n");
+    errors++;
+  }
+
+  free(ballast);
+  if(errors == 0)
+    MESSAGE("Aligned allocation handled OK\n");
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Tests the sampling profiler. The test runs itself again with
+ * MALLOC_SAMPLE set, allocates many blocks and checks that about the
+ * expected number of them show up in the profile from
+ * malloc_profile_dump(), with their size, and that the profile is empty
+ * again once they are freed. Sampled blocks are filled with a
+ * pattern and moved by realloc() like any other block.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "malloc.h"
+#include "tst.h"
+
+#define RATE "8192"
+#define BLOCKS 4000
+#define SIZE 1000
+#define EXPECTED (BLOCKS * SIZE / 8192)
+#define PROFILE "/tmp/tstprofile.heap"
+
+char *progname;
+static int errors = 0;
+static char *block[BLOCKS];
+
+/* samples: Number of samples of size bytes in the profile, -1 if it is
+   not one. Other samples are of libc, e.g. the buffers of -pg */
+static int samples(size_t size)
+{
+  char line[4096];
+  FILE *f;
+  int n = 0;
+  unsigned long objs, bytes;
+
+  if(malloc_profile_dump(PROFILE) != 0 || (f = fopen(PROFILE, "r")) == NULL)
+    return -1;
+  if(fgets(line, sizeof(line), f) == NULL ||
+     strncmp(line, "heap profile: ", 14) != 0){
+    fclose(f);
+    return -1;
+  }
+  while(fgets(line, sizeof(line), f) != NULL &&
+        sscanf(line, "%lu: %lu [", &objs, &bytes) == 2)
+    if(bytes == size)
+      n++;
+  fclose(f);
+  return n;
+}
+
+static void fill(char *p, size_t size, int seed)
+{
+  size_t i;
+  for(i = 0; i < size; i++)
+    p[i] = (seed + i) & 0xff;
+}
+
+static int check(char *p, size_t size, int seed)
+{
+  size_t i;
+  for(i = 0; i < size; i++)
+    if((p[i] & 0xff) != ((seed + i) & 0xff))
+      return 0;
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  int i, n;
+
+  if (argc > 0)
+    progname = argv[0];
+  else
+    progname = "";
+
+  if(getenv("MALLOC_SAMPLE") == NULL){
+    /* The rate is read on the first malloc() */
+    setenv("MALLOC_SAMPLE", RATE, 1);
+    execv(argv[0], argv);
+    MESSAGE("* ERROR: Could not run again with MALLOC_SAMPLE set\n");
+    return 1;
+  }
+
+  MESSAGE("-- Test sampling profiler\n");
+
+  for(i = 0; i < BLOCKS; i++){
+    if((block[i] = malloc(SIZE)) == NULL){
+      MESSAGE("* ERROR: malloc returned NULL on non-zero size request\n");
+      return 1;
+    }
+    fill(block[i], SIZE, i);
+  }
+
+  n = samples(SIZE);
+  fprintf(stderr, "%s: %d of %d blocks sampled, about %d expected\n",
+          progname, n, BLOCKS, EXPECTED);
+  if(n < EXPECTED / 2 || n > EXPECTED * 2){
+    MESSAGE("* ERROR: Wrong number of samples\n");
+    errors++;
+  }
+
+  /* Grow every block, in place, in a new heap block or mapped */
+  for(i = 0; i < BLOCKS; i++){
+    block[i] = realloc(block[i], (i % 2) ? 2 * SIZE : 200 * SIZE);
+    if(block[i] == NULL || !check(block[i], SIZE, i)){
+      MESSAGE("* ERROR: Corrupt memory handling\n");
+      errors++;
+    }
+  }
+  /* The samples follow their blocks */
+  if(samples(SIZE) != 0 || samples(200 * SIZE) <= 0){
+    MESSAGE("* ERROR: Resized blocks not in profile\n");
+    errors++;
+  }
+
+  for(i = 0; i < BLOCKS; i++)
+    free(block[i]);
+
+  n = samples(SIZE) + samples(2 * SIZE) + samples(200 * SIZE);
+  if(n != 0){
+    fprintf(stderr, "%s: %d samples left after free()\n", progname, n);
+    MESSAGE("* ERROR: Freed blocks in profile\n");
+    errors++;
+  }
+  unlink(PROFILE);
+
+  if(errors == 0)
+    MESSAGE("Profiling handled OK\n");
+  return 0;
+}
@@ -5,6 +5,25 @@
 #define SIZE 10
 #define TIMES 30000
 
+/* A block grown in place leaves a free tail in memory never used
+   before, calloc() must still clear what the tail wrote there */
+static int callocAfterGrow(void){
+  char *p, *q;
+  size_t n, i;
+
+  for(n = 2400; n <= 2600; n += 4){
+    p = malloc(2000);
+    p = realloc(p, 20000);
+    free(p);
+    q = calloc(1, n);
+    for(i = 0; i < n; i++)
+      if(q[i] != 0)
+        return 0;
+    free(q);
+  }
+  return 1;
+}
+
 int main(int argc, char *argv[]){
   char *p;
   char *progname;
@@ -16,6 +35,10 @@ int main(int argc, char *argv[]){
 
   MESSAGE("-- Test realloc() for unusual situations\n");
 
+  MESSAGE("calloc() after growing a block in place\n");
+  if (!callocAfterGrow())
+    MESSAGE("* ERROR: calloc() returned memory that is not zero\n");
+
   MESSAGE("Allocate 17 bytes with realloc(NULL, 17)\n");
   p = realloc(NULL, 17);
   if (p == NULL)
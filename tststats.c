@@ -0,0 +1,79 @@
+/*
+ * Tests mallinfo2(): the bytes in use must follow malloc() and free() of
+ * heap blocks, slab blocks and blocks with a mapping of their own, and
+ * the free heap blocks must add up to no more than the heap.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include "malloc.h"
+#include "tst.h"
+
+#define BLOCKS 100
+#define SMALL 32
+#define MEDIUM 2000
+#define LARGE (1024 * 1024)
+
+char *progname;
+static int errors = 0;
+
+static void expect(int ok, char *what)
+{
+  if(!ok){
+    fprintf(stderr, "%s: %s\n", progname, what);
+    MESSAGE("* ERROR: Wrong statistics\n");
+    errors++;
+  }
+}
+
+/* Blocks of size bytes must raise the bytes in use by at least that
+   much, and bring them back when freed */
+static void inUse(size_t size)
+{
+  struct mallinfo2 before, during, after;
+  char *block[BLOCKS];
+  int i;
+
+  before = mallinfo2();
+  for(i = 0; i < BLOCKS; i++)
+    block[i] = malloc(size);
+  during = mallinfo2();
+  for(i = 0; i < BLOCKS; i++)
+    free(block[i]);
+  after = mallinfo2();
+
+  expect(during.uordblks + during.hblkhd >=
+         before.uordblks + before.hblkhd + BLOCKS * size,
+         "bytes in use did not grow with malloc()");
+  expect(after.uordblks == before.uordblks && after.hblkhd == before.hblkhd,
+         "bytes in use did not shrink back with free()");
+}
+
+int main(int argc, char *argv[])
+{
+  struct mallinfo2 mi;
+  char *p;
+
+  if (argc > 0)
+    progname = argv[0];
+  else
+    progname = "";
+
+  MESSAGE("-- Test mallinfo2()\n");
+
+  inUse(SMALL);
+  inUse(MEDIUM);
+  inUse(LARGE);
+
+  p = malloc(LARGE);
+  mi = mallinfo2();
+  expect(mi.hblks == 1 && mi.hblkhd >= LARGE, "mapped block not counted");
+  free(p);
+  mi = mallinfo2();
+  expect(mi.hblks == 0 && mi.hblkhd == 0, "mapped block counted after free()");
+  expect(mi.fordblks <= mi.arena && mi.keepcost <= mi.fordblks,
+         "more free bytes than heap");
+
+  if(errors == 0)
+    MESSAGE("Statistics handled OK\n");
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Hammers malloc(), free() and realloc() from several threads at once.
+ * Every block is filled with a pattern owned by its thread and checked
+ * before it is released, so blocks handed out twice or overwritten by
+ * the allocator show up as corrupt memory. Half of the blocks are freed
+ * by another thread than the one that allocated them, and then every
+ * thread allocates again.
+ *
+ * Usage: t6 [threads]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "malloc.h"
+#include "tst.h"
+
+#define MAXTHREADS 64
+#define NTHREADS 8
+#define SLOTS 1000
+#define TIMES 50000
+#define MAXSIZE 4096
+
+typedef struct
+{
+  int id;
+  unsigned seed;
+  char *slot[SLOTS];
+  size_t size[SLOTS];
+} worker;
+
+static worker workers[MAXTHREADS];
+static char *handoff[MAXTHREADS][SLOTS];	/* Blocks passed to the next thread */
+static size_t handoffSize[MAXTHREADS][SLOTS];
+static pthread_barrier_t barrier;
+static int nthreads = NTHREADS;
+static int errors = 0;
+char *progname;
+
+static int pattern(int id, size_t i)
+{
+  return (id * 31 + i) & 0xff;
+}
+
+static void fill(int id, char *p, size_t size)
+{
+  size_t i;
+  for(i = 0; i < size; i++)
+    p[i] = pattern(id, i);
+}
+
+static void check(int id, char *p, size_t size)
+{
+  size_t i;
+  for(i = 0; i < size; i++)
+    if((p[i] & 0xff) != pattern(id, i)){
+      MESSAGE("* ERROR: Corrupt memory handling\n");
+      __sync_fetch_and_add(&errors, 1);
+      return;
+    }
+}
+
+static void *run(void *arg)
+{
+  worker *w = arg;
+  int i, j, next;
+  size_t size;
+
+  for(i = 0; i < TIMES; i++){
+    j = rand_r(&w->seed) % SLOTS;
+    if(w->slot[j] == NULL){
+      /* Mostly small blocks so the thread caches are exercised */
+      size = (rand_r(&w->seed) % 4 == 0) ? rand_r(&w->seed) % MAXSIZE + 1
+                                         : rand_r(&w->seed) % 256 + 1;
+      if((w->slot[j] = malloc(size)) == NULL){
+        MESSAGE("* ERROR: malloc returned NULL on non-zero size request\n");
+        __sync_fetch_and_add(&errors, 1);
+        continue;
+      }
+      w->size[j] = size;
+      fill(w->id, w->slot[j], size);
+    }
+    else if(rand_r(&w->seed) % 4 == 0){
+      check(w->id, w->slot[j], w->size[j]);
+      size = rand_r(&w->seed) % MAXSIZE + 1;
+      w->slot[j] = realloc(w->slot[j], size);
+      if(w->slot[j] == NULL){
+        MESSAGE("* ERROR: realloc returned NULL on non-zero size request\n");
+        __sync_fetch_and_add(&errors, 1);
+        continue;
+      }
+      w->size[j] = size;
+      fill(w->id, w->slot[j], size);
+    }
+    else{
+      check(w->id, w->slot[j], w->size[j]);
+      free(w->slot[j]);
+      w->slot[j] = NULL;
+    }
+  }
+
+  /* Hand every other block over to the next thread */
+  for(j = 0; j < SLOTS; j += 2){
+    handoff[w->id][j] = w->slot[j];
+    handoffSize[w->id][j] = w->size[j];
+    w->slot[j] = NULL;
+  }
+  pthread_barrier_wait(&barrier);
+
+  next = (w->id + 1) % nthreads;
+  for(j = 0; j < SLOTS; j++){
+    if(handoff[next][j] != NULL){
+      check(next, handoff[next][j], handoffSize[next][j]);
+      free(handoff[next][j]);
+    }
+    if(w->slot[j] != NULL){
+      check(w->id, w->slot[j], w->size[j]);
+      free(w->slot[j]);
+      w->slot[j] = NULL;
+    }
+  }
+  pthread_barrier_wait(&barrier);
+
+  /* Allocate again, reusing the blocks freed by the other thread */
+  for(j = 0; j < SLOTS; j++){
+    size = rand_r(&w->seed) % MAXSIZE + 1;
+    if((w->slot[j] = malloc(size)) == NULL){
+      MESSAGE("* ERROR: malloc returned NULL on non-zero size request\n");
+      __sync_fetch_and_add(&errors, 1);
+      continue;
+    }
+    w->size[j] = size;
+    fill(w->id, w->slot[j], size);
+  }
+  for(j = 0; j < SLOTS; j++){
+    if(w->slot[j] != NULL){
+      check(w->id, w->slot[j], w->size[j]);
+      free(w->slot[j]);
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  pthread_t thread[MAXTHREADS];
+  int i;
+
+  if (argc > 0)
+    progname = argv[0];
+  else
+    progname = "";
+  if (argc > 1)
+    nthreads = atoi(argv[1]);
+  if (nthreads < 1 || nthreads > MAXTHREADS)
+    nthreads = NTHREADS;
+
+  fprintf(stderr, "%s: -- Test malloc() from %d threads at once\n",
+          progname, nthreads);
+
+  pthread_barrier_init(&barrier, NULL, nthreads);
+  for(i = 0; i < nthreads; i++){
+    workers[i].id = i;
+    workers[i].seed = i + 1;
+    if(pthread_create(&thread[i], NULL, run, &workers[i]) != 0){
+      MESSAGE("* ERROR: Could not create thread\n");
+      return 1;
+    }
+  }
+  for(i = 0; i < nthreads; i++)
+    pthread_join(thread[i], NULL);
+
+  if(errors == 0)
+    MESSAGE("Threads handled OK\n");
+  return 0;
+}